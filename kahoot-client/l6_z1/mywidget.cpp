@@ -3,7 +3,7 @@
 
 #include <QMessageBox>
 
-MyWidget::MyWidget(QWidget *parent) : QWidget(parent), ui(new Ui::MyWidget) {
+MyWidget::MyWidget(QWidget *parent) : QWidget(parent), ui(new Ui::MyWidget), binaryMode(false) {
     ui->setupUi(this);
 
     connect(ui->conectBtn, &QPushButton::clicked, this, &MyWidget::connectBtnHit);
@@ -68,6 +68,11 @@ void MyWidget::socketConnected(){
     connTimeoutTimer->stop();
     connTimeoutTimer->deleteLater();
     ui->talkGroup->setEnabled(true);
+
+    // everything up to the server's acknowledgement is still text
+    inbox.clear();
+    binaryMode = false;
+    sock->write(BINARY_HELLO "\n");
 }
 
 void MyWidget::socketDisconnected(){
@@ -86,68 +91,113 @@ void MyWidget::socketError(QTcpSocket::SocketError err){
 }
 
 void MyWidget::socketReadable(){
+    inbox.append(sock->readAll());
+    while(true){
+        if(!binaryMode){
+            // text messages end with a null character, the server switches after acknowledging the hello
+            int end = inbox.indexOf('\0');
+            if(end == -1)
+                return;
+            QByteArray msg = inbox.left(end);
+            inbox.remove(0, end + 1);
+            if(msg == BINARY_HELLO)
+                binaryMode = true;
+            else
+                textMessage(msg);
+            continue;
+        }
+
+        // [type][length, 2 bytes big endian][payload]
+        if(inbox.size() < 3)
+            return;
+        int length = ((quint8)inbox[1] << 8) | (quint8)inbox[2];
+        if(inbox.size() < 3 + length)
+            return;
+        Op op = (Op)(quint8)inbox[0];
+        QString payload = QString::fromUtf8(inbox.mid(3, length));
+        inbox.remove(0, 3 + length);
+
+        if(op == Op::Question){
+            // question text followed by the four answears, one per line
+            QStringList parts = payload.split('\n');
+            QString question = parts.value(0);
+            const char *labels[] = {"A", "B", "C", "D"};
+            for(int i = 0; i < 4; i++)
+                question += QString("\n") + labels[i] + ": " + parts.value(i + 1);
+            payload = question;
+        }
+        showMessage(op, payload.trimmed());
+    }
+}
 
+void MyWidget::textMessage(const QByteArray &msg){
+    QString text = QString::fromUtf8(msg).trimmed();
+    if(text.startsWith("MM:==="))
+        showMessage(Op::MainMenu, text.remove(0,3));
+    else if(text.startsWith("MM:"))
+        showMessage(Op::MenuNotice, text.remove(0,3));
+    else if(text.startsWith("MH:Quiz created"))
+        showMessage(Op::HostNotice, text.remove(0,3));
+    else if(text.startsWith("MH"))
+        showMessage(Op::HostMenu, text.remove(0,3));
+    else if(text.startsWith("MP"))
+        showMessage(Op::PlayerMenu, text.remove(0,3));
+    else if(text.startsWith("Q"))
+        showMessage(Op::Question, text.remove(0,2));
+    else if(text.startsWith("S"))
+        showMessage(Op::ScoreBoard, text.remove(0,2));
+    else
+        showMessage(Op::Text, text);
+}
 
-    QByteArray ba = sock->readAll();
-    if(QString::fromUtf8(ba).trimmed().startsWith("MM:===")){
-        ui->stackedWidget->setCurrentIndex(1);
-        ui->lineEditMM->setEnabled(true);
-        ui->textEditMM->clear();
-        ui->textEditMM->append(QString::fromUtf8(ba).trimmed().remove(0,3));
-        ui->textEditMM->setAlignment(Qt::AlignLeft);
-    }
-    else if(QString::fromUtf8(ba).trimmed().startsWith("MM:Room does not exist")){
+void MyWidget::showMessage(Op op, const QString &body){
+    switch(op){
+    case Op::MainMenu:
+    case Op::MenuNotice:
         ui->stackedWidget->setCurrentIndex(1);
-        ui->lineEditMM->setEnabled(false);
+        ui->lineEditMM->setEnabled(op == Op::MainMenu);
         ui->textEditMM->clear();
-        ui->textEditMM->append(QString::fromUtf8(ba).trimmed().remove(0,3));
+        ui->textEditMM->append(body);
         ui->textEditMM->setAlignment(Qt::AlignLeft);
-    }
-    else if(QString::fromUtf8(ba).trimmed().startsWith("MH:Quiz created")){
-        ui->stackedWidget->setCurrentIndex(2);
-        ui->textEditMH->clear();
-        ui->lineEditMH->setEnabled(false);
-        ui->textEditMH->append(QString::fromUtf8(ba).trimmed().remove(0,3));
-        ui->textEditMH->setAlignment(Qt::AlignLeft);
-    }
-    else if(QString::fromUtf8(ba).trimmed().startsWith("MH")){
+        break;
+    case Op::HostMenu:
+    case Op::HostNotice:
         ui->stackedWidget->setCurrentIndex(2);
         ui->textEditMH->clear();
-        ui->lineEditMH->setEnabled(true);
-        ui->textEditMH->append(QString::fromUtf8(ba).trimmed().remove(0,3));
+        ui->lineEditMH->setEnabled(op == Op::HostMenu);
+        ui->textEditMH->append(body);
         ui->textEditMH->setAlignment(Qt::AlignLeft);
-    }
-    else if(QString::fromUtf8(ba).trimmed().startsWith("MP")){
+        break;
+    case Op::PlayerMenu:
         ui->stackedWidget->setCurrentIndex(3);
         ui->textEditMP->clear();
-        ui->textEditMP->append(QString::fromUtf8(ba).trimmed().remove(0,3));
+        ui->textEditMP->append(body);
         ui->textEditMP->setAlignment(Qt::AlignLeft);
-    }
-    else if(QString::fromUtf8(ba).trimmed().startsWith("Q")){
+        break;
+    case Op::Question:
         ui->stackedWidget->setCurrentIndex(4);
         ui->groupBox_4->setEnabled(true);
         ui->textEditQ->clear();
-        ui->textEditQ->append(QString::fromUtf8(ba).trimmed().remove(0,2));
+        ui->textEditQ->append(body);
         ui->textEditQ->setAlignment(Qt::AlignLeft);
-    }
-    else if(QString::fromUtf8(ba).trimmed().startsWith("S")){
+        break;
+    case Op::AnswearAck:
+        ui->textEditQ->clear();
+        ui->textEditQ->append("Answear received. Waiting for other players...");
+        break;
+    case Op::ScoreBoard:
         ui->stackedWidget->setCurrentIndex(5);
-        ui->textEditS->append(QString::fromUtf8(ba).trimmed().remove(0,2));
+        ui->textEditS->append(body);
         ui->textEditS->setAlignment(Qt::AlignLeft);
-    }
-    else if(QString::fromUtf8(ba).trimmed().startsWith("Choose your nickname")){
+        break;
+    default:
         ui->stackedWidget->setCurrentIndex(0);
-        ui->msgsTextEdit->append(QString::fromUtf8(ba).trimmed());
+        ui->msgsTextEdit->append(body);
         ui->msgsTextEdit->setAlignment(Qt::AlignLeft);
         ui->msgLineEdit->setFocus();
-    }
-    else{
-        ui->stackedWidget->setCurrentIndex(0);
-        ui->msgsTextEdit->append(QString::fromUtf8(ba).trimmed());
-        ui->msgsTextEdit->setAlignment(Qt::AlignLeft);
-        ui->msgLineEdit->setFocus();
-        ui->connectGroup->setEnabled(true);
-
+        if(!body.startsWith("Choose your nickname"))
+            ui->connectGroup->setEnabled(true);
+        break;
     }
 }
 
@@ -9,10 +9,26 @@ namespace Ui {
 class MyWidget;
 }
 
+// line sent on connect to switch the server to the binary protocol
+#define BINARY_HELLO "BIN1"
+
 class MyWidget : public QWidget
 {
     Q_OBJECT
 
+    // message types of the binary protocol, must match server.cpp
+    enum class Op : quint8 {
+        Text = 1,
+        MainMenu,
+        MenuNotice,
+        HostMenu,
+        HostNotice,
+        PlayerMenu,
+        Question,
+        AnswearAck,
+        ScoreBoard
+    };
+
 public:
     explicit MyWidget(QWidget *parent = 0);
     ~MyWidget();
@@ -25,6 +41,8 @@ protected:
     void socketDisconnected();
     void socketError(QTcpSocket::SocketError);
     void socketReadable();
+    void textMessage(const QByteArray &msg);
+    void showMessage(Op op, const QString &body);
     void sendBtnHit();
     void sendBtnHitMM();
     void sendBtnHitMH();
@@ -40,6 +58,10 @@ protected:
 private:
     Ui::MyWidget * ui;
 
+    // bytes received but not yet split into messages
+    QByteArray inbox;
+    bool binaryMode;
+
 
 };
 
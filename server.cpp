@@ -1,15 +1,22 @@
 #include <cstdlib>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <error.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <string.h>
 #include <thread>
 #include <mutex>
 #include <unordered_set>
+#include <unordered_map>
 #include <signal.h>
 #include <vector>
 #include <set>
@@ -17,10 +24,127 @@
 #include <map>
 #include <iostream>
 #include <chrono>
+#include <memory>
+#include <functional>
+#include <list>
+#include <algorithm>
+#include <deque>
+#include <string_view>
+#include <charconv>
+#include <random>
+#include <atomic>
+#include <pthread.h>
+#include <fstream>
+#include <coroutine>
+#include <optional>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
 using namespace std::chrono;
 
 #define MAXLENGTH 4096
 
+// max number of events handled per epoll_wait call
+#define MAXEVENTS 256
+
+// timer wheel resolution in miliseconds
+#define TIMER_TICK 10
+
+// seconds a client has to pick a nickname
+#define NICKNAME_TIMEOUT 60
+
+// default queue of not yet accepted connections per listener (the kernel caps it at somaxconn)
+#define LISTEN_BACKLOG 1024
+
+// connections accepted per wakeup before the reactor turns to its other clients
+#define ACCEPT_BATCH 64
+
+// default number of clients that may be picking a nickname at once, later ones are turned away
+#define MAX_PENDING_NICKNAMES 512
+
+// miliseconds a client turned away is asked to wait before it retries
+#define BUSY_RETRY_DELAY 500
+
+// miliseconds the first reactor waits for the others to say goodbye to their clients on shutdown
+#define SHUTDOWN_GRACE 1000
+
+// seconds a lobby may stay without anyone joining, leaving or starting it
+#define LOBBY_IDLE_TIMEOUT 600
+
+// seconds a finished room is kept before it's erased
+#define ROOM_TEARDOWN_DELAY 1
+
+// join codes are drawn from this range, a room keeps its code until it's erased
+#define ROOM_CODE_MIN 100000
+#define ROOM_CODE_MAX 999999
+
+// lobbies listed per page of the join menu
+#define LOBBY_PAGE_SIZE 20
+
+// players a lobby lists by name, the rest are only counted
+#define LOBBY_LIST_NAMES 50
+
+// quizzes listed per page of the host's quiz menu
+#define QUIZ_PAGE_SIZE 20
+
+// matches kept for one search, a broader search has to be narrowed down
+#define QUIZ_SEARCH_LIMIT 1000
+
+// seconds to answear a question unless its quiz says otherwise, and the allowed range
+#define ANSWEAR_TIME 20
+#define ANSWEAR_TIME_MIN 5
+#define ANSWEAR_TIME_MAX 300
+
+// max bytes of quiz source a host can send with one UPLOAD command
+#define UPLOAD_LIMIT (1024 * 1024)
+
+// longest quiz title and question or answear text a quiz source may have
+#define QUIZ_TITLE_MAX 200
+#define QUIZ_TEXT_MAX 1000
+
+// players listed on the score board
+#define SCOREBOARD_SIZE 3
+
+// default bytes queued for a client before it counts as a slow consumer
+#define OUT_HIGH_WATER (64 * 1024)
+
+// default bytes queued for a client before it is disconnected right away
+#define OUT_HARD_LIMIT (1024 * 1024)
+
+// default seconds a slow consumer gets to drain below the high-water mark
+#define SLOW_CONSUMER_TIMEOUT 10
+
+// a new room is only placed on another reactor if that one serves this many clients fewer
+#define ROOM_PLACEMENT_SLACK 8
+
+// clients that can wait in a reactor's mailbox, a power of two
+#define MAILBOX_CAPACITY 1024
+
+// max frames written by one writev call
+#define OUT_BATCH 64
+
+// line a client sends instead of its nickname to switch to the binary protocol
+#define BINARY_HELLO "BIN1"
+
+// message types of the binary protocol, each frame is [type][length, 2 bytes big endian][payload]
+enum class Op : uint8_t
+{
+    Text = 1,
+    MainMenu,
+    MenuNotice,
+    HostMenu,
+    HostNotice,
+    PlayerMenu,
+    Question,
+    AnswearAck,
+    ScoreBoard
+};
+
+// an outgoing message, shared by every client it is queued for
+typedef std::shared_ptr<const std::string> Frame;
+
+// builds a binary frame
+Frame binaryFrame(Op op, std::string_view payload);
+
 class Question
 {
 public:
@@ -28,6 +152,35 @@ public:
     std::string answearA, answearB, answearC, answearD;
     std::string correctAnswear;
     int answearTime;
+
+    // the "Q:" message and its binary form, built once and shared by every room and player asked this question
+    Frame frame;
+    Frame binary;
+
+    void serialize()
+    {
+        std::string msg = "Q:";
+        msg += questionText;
+        msg += "\nA: ";
+        msg += answearA;
+        msg += "\nB: ";
+        msg += answearB;
+        msg += "\nC: ";
+        msg += answearC;
+        msg += "\nD: ";
+        msg += answearD;
+        msg += "\n";
+        frame = std::make_shared<const std::string>(std::move(msg));
+
+        // the binary form leaves the formatting to the client
+        std::string payload = questionText;
+        for (const std::string *answear : {&answearA, &answearB, &answearC, &answearD})
+        {
+            payload += '\n';
+            payload += *answear;
+        }
+        binary = binaryFrame(Op::Question, payload);
+    }
 };
 
 class Quiz
@@ -40,1156 +193,3676 @@ public:
     }
     Quiz(std::vector<Question> question_set, std::string title)
     {
-        questions = question_set;
-        quizTitle = title;
+        questions = std::move(question_set);
+        quizTitle = std::move(title);
+        for (Question &q : questions)
+            q.serialize();
     }
     void addQuestion(Question q)
     {
-        questions.push_back(q);
+        q.serialize();
+        questions.push_back(std::move(q));
     }
 };
 
-class Player
+// a finished quiz, rooms and rounds borrow it instead of copying its questions
+typedef std::shared_ptr<const Quiz> QuizRef;
+
+// finds quizzes by any part of their title, words like "#history" in a title work as tags
+class QuizIndex
 {
 private:
-    std::string nickname;
-    int playerID;
-    int score = 0;
-    bool waiting;
+    // quiz ids for every three characters that appear in a title, in increasing order
+    std::unordered_map<uint32_t, std::vector<uint32_t>> trigrams;
 
-public:
-    Player(int id)
+    // lower case titles, candidates are checked against them
+    std::vector<std::string> titles;
+
+    static uint32_t trigram(const char *text)
     {
-        playerID = id;
-        nickname = "player ";
-        nickname += std::to_string(id);
+        return (uint8_t)text[0] << 16 | (uint8_t)text[1] << 8 | (uint8_t)text[2];
     }
-    Player()
+
+    // first position from cur on holding an id not below id, steps grow so long runs are skipped quickly
+    static const uint32_t *seek(const uint32_t *cur, const uint32_t *end, uint32_t id)
     {
-        nickname = "offline";
+        size_t step = 1;
+        const uint32_t *probe = cur;
+        while (probe != end && *probe < id)
+        {
+            cur = probe + 1;
+            probe = (size_t)(end - cur) > step ? cur + step : end;
+            step *= 2;
+        }
+        return std::lower_bound(cur, probe, id);
     }
-    void addToScore(int amount) { score += amount; }
-
-    std::string getNickname() { return nickname; }
-    int getScore() { return score; }
-    int getPlayerID() { return playerID; }
-    bool getWaiting() { return waiting; }
-
-    void setNickname(std::string nick) { nickname = nick; }
-    void setScore(int scr) { score = scr; }
-    void setPlayerID(int id) { playerID = id; }
-    void setWaiting(bool b) { waiting = b; }
-};
 
-class Room
-{
 public:
-    Player owner;
-    int RoomId;
-    int playerCount = 0;
-    int playerAnswearsCount = 0;
-    bool inGame = false;
-    std::unordered_set<int> playersInRoom;
-    Quiz quiz;
-
-    Room(Player ownr)
+    static std::string fold(std::string_view text)
     {
-        owner = ownr;
-        RoomId = owner.getPlayerID() * 123;
+        std::string folded(text);
+        for (char &c : folded)
+            c = tolower((unsigned char)c);
+        return folded;
     }
 
-    ~Room()
+    // quizzes are numbered in the order they are added
+    void add(std::string_view title)
     {
-        playersInRoom.clear();
+        uint32_t id = titles.size();
+        titles.push_back(fold(title));
+        const std::string &folded = titles.back();
+        for (size_t i = 0; i + 3 <= folded.size(); i++)
+        {
+            std::vector<uint32_t> &ids = trigrams[trigram(folded.data() + i)];
+            if (ids.empty() || ids.back() != id)
+                ids.push_back(id);
+        }
     }
 
-    void addPlayer(int playerID)
+    void clear()
     {
-        playersInRoom.insert(playerID);
-        playerCount++;
+        trigrams.clear();
+        titles.clear();
     }
 
-    void removePlayer(int playerID)
+    // ids of the first quizzes whose title contains the query, in catalog order
+    std::vector<uint32_t> search(std::string_view query, size_t limit) const
     {
-        playersInRoom.erase(playerID);
-        playerCount--;
-    }
+        std::string folded = fold(query);
+        std::vector<uint32_t> found;
+        if (folded.size() < 3)
+        {
+            // too short for the index, scanning the titles is still quick
+            for (uint32_t id = 0; id < titles.size() && found.size() < limit; id++)
+            {
+                if (titles[id].find(folded) != std::string::npos)
+                    found.push_back(id);
+            }
+            return found;
+        }
 
-    void addAnswear()
-    {
-        playerAnswearsCount++;
+        // walks the rarest trigram's ids, the other lists only have to be skipped through
+        std::vector<std::pair<const uint32_t *, const uint32_t *>> lists;
+        for (size_t i = 0; i + 3 <= folded.size(); i++)
+        {
+            auto it = trigrams.find(trigram(folded.data() + i));
+            if (it == trigrams.end())
+                return found;
+            lists.push_back({it->second.data(), it->second.data() + it->second.size()});
+        }
+        std::sort(lists.begin(), lists.end(), [](auto &a, auto &b) { return a.second - a.first < b.second - b.first; });
+        for (const uint32_t *id = lists[0].first; id != lists[0].second && found.size() < limit; id++)
+        {
+            bool everywhere = true;
+            for (size_t l = 1; everywhere && l < lists.size(); l++)
+            {
+                lists[l].first = seek(lists[l].first, lists[l].second, *id);
+                everywhere = lists[l].first != lists[l].second && *lists[l].first == *id;
+            }
+
+            // the trigrams may all be there without forming the query
+            if (everywhere && titles[*id].find(folded) != std::string::npos)
+                found.push_back(*id);
+        }
+        return found;
     }
 };
 
-// store player info
-std::map<int,Player> players_map;
-
-int playersConnected = 0;
-
-std::mutex notifyFdMutex;
-std::mutex notifyRoomMutex;
-
-// server socket
-int servFd;
-
-// condition variables
-
-std::condition_variable controlQuestionsCv;
+// quiz bank file, all numbers in host byte order:
+//   "KQB2" | u32 quiz count | count x {u64 offset, u64 size, u64 title offset, u64 title size} | titles | quiz bodies
+// a body is the title, a u32 question count and for every question the text, answears A-D
+// and the correct answear (each a u16 length and the bytes) followed by the u16 answear time,
+// the titles are also stored side by side so listing and indexing them never reads a body
+#define BANK_MAGIC "KQB2"
 
-std::condition_variable startGameCv;
-
-std::condition_variable endGameCv;
-
-std::condition_variable endRoundCv;
-
-// determines which controlQuestionsCv to notify
-int notifyFd = 0;
-
-// determines which startGameCv to notify
-int notifyRoomId = 0;
-
-// client sockets
-std::mutex clientFdsLock;
-std::unordered_set<int> clientFds;
-
-// stores game rooms info
-std::map<int, Room> gameRooms;
-
-std::vector<Quiz> quizSet;
-
-// handles SIGINT
-void ctrl_c(int);
-
-// handles interaction with the client
-void clientLoop(int clientFd);
-
-// prompts client to provide a valid nickname
-void setPlayerNickname(int fd);
-
-// checks nickname availability
-bool validNickname(std::string nickname);
-
-// sends given questions to the players
-void askQuestion(Question q, std::unordered_set<int> players, int ownerFd);
-
-// sends questions to players within one room
-void questionHandler(Question q, std::unordered_set<int> players);
-
-// waits for player answears, determines if the answears are correct and adds up score based on answear speed
-void answearHandler(Question q, std::unordered_set<int> players_set, int owner);
-
-// send score board to the players (top 3 players and an individual score if the player is not in the top 3)
-void sendScoreBoard(std::unordered_set<int> playersInRoom,int owner);
+// every quiz a host can pick: the memory-mapped bank first, then the ones kept in memory,
+// a published catalog is never changed, adding a quiz publishes a copy sharing the bank
+class QuizCatalog
+{
+private:
+    struct BankEntry
+    {
+        uint64_t offset;
+        uint64_t size;
+        uint64_t titleOffset;
+        uint64_t titleSize;
+    };
+
+    // reads a body, every read is checked against its end
+    struct BankReader
+    {
+        const char *pos;
+        const char *end;
 
-// quiz creation for the host
-void createQuiz(int clientFd);
+        bool number(void *out, size_t size)
+        {
+            if ((size_t)(end - pos) < size)
+                return false;
+            memcpy(out, pos, size);
+            pos += size;
+            return true;
+        }
 
-// initializes sample quizzes
-void loadSampleQuizzes();
+        bool text(std::string &out)
+        {
+            uint16_t length;
+            if (!number(&length, sizeof(length)) || end - pos < length)
+                return false;
+            out.assign(pos, length);
+            pos += length;
+            return true;
+        }
+    };
 
-// allows player to leave a lobby before the game starts
-void handleLeave(int clientFd);
+    // the mapped file and its title index, shared by every catalog built on it and never changed
+    class Bank
+    {
+    private:
+        const char *data = nullptr;
+        size_t dataSize = 0;
+        uint32_t count = 0;
+        const BankEntry *index = nullptr;
+        QuizIndex titleIndex;
+
+        // bank quizzes parsed so far, a quiz is dropped again once no room uses it
+        std::mutex loadedLock;
+        std::unordered_map<uint32_t, std::weak_ptr<const Quiz>> loaded;
+
+    public:
+        Bank() = default;
+        Bank(const Bank &) = delete;
+        Bank &operator=(const Bank &) = delete;
+
+        // unmapped once no catalog holds the bank anymore
+        ~Bank()
+        {
+            if (data)
+                munmap((void *)data, dataSize);
+        }
 
-// converts cstring to port
-uint16_t readPort(char *txt);
+        // maps a bank file, only its index and titles are read up front
+        bool open(const char *path)
+        {
+            int fd = ::open(path, O_RDONLY);
+            if (fd == -1)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) == -1 || st.st_size < 8)
+            {
+                close(fd);
+                return false;
+            }
+            void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mapped == MAP_FAILED)
+                return false;
+
+            // hosts pick quizzes at random, read-ahead would only waste memory
+            madvise(mapped, st.st_size, MADV_RANDOM);
+
+            const char *file = (const char *)mapped;
+            uint32_t entries;
+            memcpy(&entries, file + 4, sizeof(entries));
+            size_t indexEnd = 8 + (size_t)entries * sizeof(BankEntry);
+            bool valid = memcmp(file, BANK_MAGIC, 4) == 0 && indexEnd <= (size_t)st.st_size;
+            size_t titlesEnd = indexEnd;
+            for (uint32_t i = 0; valid && i < entries; i++)
+            {
+                const BankEntry *entry = (const BankEntry *)(file + 8) + i;
+                valid = entry->offset >= indexEnd && entry->offset <= (size_t)st.st_size && entry->size <= st.st_size - entry->offset &&
+                        entry->titleOffset >= indexEnd && entry->titleOffset <= (size_t)st.st_size &&
+                        entry->titleSize <= st.st_size - entry->titleOffset;
+                if (valid)
+                    titlesEnd = std::max<size_t>(titlesEnd, entry->titleOffset + entry->titleSize);
+            }
+            if (!valid)
+            {
+                munmap(mapped, st.st_size);
+                errno = EINVAL;
+                return false;
+            }
 
-// sets SO_REUSEADDR
-void setReuseAddr(int sock);
+            data = file;
+            dataSize = st.st_size;
+            count = entries;
+            index = (const BankEntry *)(file + 8);
 
-void sendLobbyInfo(Room room);
+            // the index and the titles are read in one go, the bodies only when a quiz is picked
+            madvise(mapped, titlesEnd, MADV_WILLNEED);
+            for (uint32_t i = 0; i < count; i++)
+                titleIndex.add(title(i));
+            return true;
+        }
 
-int main(int argc, char **argv)
-{
+        uint32_t size() const
+        {
+            return count;
+        }
 
-    // get and validate port number
-    if (argc != 2)
-        error(1, 0, "Need 1 arg (port)");
-    auto port = readPort(argv[1]);
+        std::string title(uint32_t i) const
+        {
+            return std::string(data + index[i].titleOffset, index[i].titleSize);
+        }
 
-    // create socket
-    servFd = socket(AF_INET, SOCK_STREAM, 0);
-    if (servFd == -1)
-        error(1, errno, "socket failed");
+        // parsed outside the lock, two hosts picking the same quiz at once may both parse it
+        QuizRef get(uint32_t i)
+        {
+            {
+                std::unique_lock<std::mutex> lock(loadedLock);
+                auto it = loaded.find(i);
+                if (it != loaded.end())
+                {
+                    if (QuizRef quiz = it->second.lock())
+                        return quiz;
+                }
+            }
+            QuizRef quiz = decodeQuiz(data + index[i].offset, index[i].size);
+            if (quiz)
+            {
+                std::unique_lock<std::mutex> lock(loadedLock);
+                loaded[i] = quiz;
+            }
+            return quiz;
+        }
 
-    // graceful ctrl+c exit
-    signal(SIGINT, ctrl_c);
+        std::vector<uint32_t> find(std::string_view query, size_t limit) const
+        {
+            return titleIndex.search(query, limit);
+        }
+    };
 
-    // prevent dead sockets from raising pipe signals on write
-    signal(SIGPIPE, SIG_IGN);
+    // the bank, none if the server runs without one
+    std::shared_ptr<Bank> bank;
 
-    setReuseAddr(servFd);
+    // sample, created and uploaded quizzes, numbered after the bank
+    std::vector<QuizRef> inMemory;
+    QuizIndex memoryIndex;
 
-    // bind to any address and port provided in arguments
-    sockaddr_in serverAddr{.sin_family = AF_INET, .sin_port = htons((short)port), .sin_addr = {INADDR_ANY}};
-    int res = bind(servFd, (sockaddr *)&serverAddr, sizeof(serverAddr));
-    if (res)
-        error(1, errno, "bind failed");
+    uint32_t bankCount() const
+    {
+        return bank ? bank->size() : 0;
+    }
 
-    printf("Server started.\n");
+    static void putText(std::string &out, const std::string &text)
+    {
+        uint16_t length = std::min<size_t>(text.size(), 0xFFFF);
+        out.append((const char *)&length, sizeof(length));
+        out.append(text, 0, length);
+    }
 
-    printf("Listening  for connections...\n");
+public:
+    // maps a bank file in place of the current one
+    bool openBank(const char *path)
+    {
+        auto next = std::make_shared<Bank>();
+        if (!next->open(path))
+            return false;
+        bank = std::move(next);
+        return true;
+    }
 
-    // enter listening mode
-    res = listen(servFd, 1);
-    if (res)
-        error(1, errno, "listen failed");
+    size_t size() const
+    {
+        return bankCount() + inMemory.size();
+    }
 
-    // load sample quizzes
-    loadSampleQuizzes();
+    // title without parsing the rest of the quiz
+    std::string title(size_t i) const
+    {
+        if (i >= bankCount())
+            return inMemory.at(i - bankCount())->quizTitle;
+        return bank->title(i);
+    }
 
-    /****************************/
+    // the quiz, parsed from the bank when it's not in use already, nullptr if it's malformed
+    QuizRef get(size_t i) const
+    {
+        if (i >= bankCount())
+            return inMemory.at(i - bankCount());
+        return bank->get(i);
+    }
 
-    while (true)
+    // only done to a catalog that isn't published yet
+    void add(QuizRef quiz)
     {
+        memoryIndex.add(quiz->quizTitle);
+        inMemory.push_back(std::move(quiz));
+    }
 
-        // prepare placeholders for client address
-        sockaddr_in clientAddr{};
-        socklen_t clientAddrSize = sizeof(clientAddr);
+    // takes over the sample and created quizzes of the catalog this one replaces
+    void adopt(const QuizCatalog &previous)
+    {
+        inMemory = previous.inMemory;
+        memoryIndex = previous.memoryIndex;
+    }
 
-        // accept new connection
-        auto clientFd = accept(servFd, (sockaddr *)&clientAddr, &clientAddrSize);
-        if (clientFd == -1)
-            error(1, errno, "accept failed");
+    // numbers of the quizzes with the query in their title
+    std::vector<uint32_t> find(std::string_view query) const
+    {
+        std::vector<uint32_t> found;
+        if (bank)
+            found = bank->find(query, QUIZ_SEARCH_LIMIT);
+        for (uint32_t id : memoryIndex.search(query, QUIZ_SEARCH_LIMIT - found.size()))
+            found.push_back(bankCount() + id);
+        return found;
+    }
 
-        // add client to all clients set
+    // appends the quiz body to out
+    static void encodeQuiz(std::string &out, const Quiz &quiz)
+    {
+        putText(out, quiz.quizTitle);
+        uint32_t questions = quiz.questions.size();
+        out.append((const char *)&questions, sizeof(questions));
+        for (const Question &q : quiz.questions)
         {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            clientFds.insert(clientFd);
+            for (const std::string *text : {&q.questionText, &q.answearA, &q.answearB, &q.answearC, &q.answearD, &q.correctAnswear})
+                putText(out, *text);
+            uint16_t answearTime = q.answearTime;
+            out.append((const char *)&answearTime, sizeof(answearTime));
         }
+    }
 
-        // tell who has connected
-        printf("new connection from: %s:%hu (fd: %d)\n", inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port), clientFd);
+    // parses a quiz body, nullptr if it's malformed
+    static QuizRef decodeQuiz(const char *data, size_t size)
+    {
+        Quiz parsed;
+        BankReader reader{data, data + size};
+        uint32_t questions;
+        if (!reader.text(parsed.quizTitle) || !reader.number(&questions, sizeof(questions)))
+            return nullptr;
+        for (uint32_t q = 0; q < questions; q++)
+        {
+            Question question;
+            uint16_t answearTime;
+            if (!reader.text(question.questionText) || !reader.text(question.answearA) ||
+                !reader.text(question.answearB) || !reader.text(question.answearC) ||
+                !reader.text(question.answearD) || !reader.text(question.correctAnswear) ||
+                !reader.number(&answearTime, sizeof(answearTime)))
+                return nullptr;
+
+            // the same rules as for a quiz source, a broken record must not score players who didn't answear
+            const std::string &correct = question.correctAnswear;
+            if (correct.size() != 1 || correct[0] < 'A' || correct[0] > 'D' ||
+                answearTime < ANSWEAR_TIME_MIN || answearTime > ANSWEAR_TIME_MAX)
+                return nullptr;
+            question.answearTime = answearTime;
+            parsed.addQuestion(std::move(question));
+        }
+        return std::make_shared<const Quiz>(std::move(parsed));
+    }
 
-        // create a new player
-        Player p(clientFd);
-        players_map.insert(std::pair<int,Player>(clientFd,p));
-        //players[clientFd] = Player(clientFd);
+    // writes the quizzes as a bank file
+    static bool writeBank(const char *path, const std::vector<QuizRef> &quizzes)
+    {
+        std::string titles;
+        for (const QuizRef &quiz : quizzes)
+            titles += quiz->quizTitle;
+
+        std::string bodies;
+        std::vector<BankEntry> entries;
+        size_t indexEnd = 8 + quizzes.size() * sizeof(BankEntry);
+        size_t titleStart = indexEnd;
+        for (const QuizRef &quiz : quizzes)
+        {
+            size_t start = bodies.size();
+            encodeQuiz(bodies, *quiz);
+            entries.push_back({indexEnd + titles.size() + start, bodies.size() - start, titleStart, quiz->quizTitle.size()});
+            titleStart += quiz->quizTitle.size();
+        }
 
-        // client threads
-        /******************************/
-        std::thread([clientFd] {
-            clientLoop(clientFd);
-        }).detach();
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        uint32_t count = quizzes.size();
+        out.write(BANK_MAGIC, 4);
+        out.write((const char *)&count, sizeof(count));
+        out.write((const char *)entries.data(), entries.size() * sizeof(BankEntry));
+        out.write(titles.data(), titles.size());
+        out.write(bodies.data(), bodies.size());
+        return (bool)out;
     }
-    /*****************************/
-}
+};
 
-uint16_t readPort(char *txt)
+// crc-32 (IEEE) of the bytes
+uint32_t checksum(const char *data, size_t size)
 {
-    char *ptr;
-    auto port = strtol(txt, &ptr, 10);
-    if (*ptr != 0 || port < 1 || (port > ((1 << 16) - 1)))
-        error(1, 0, "illegal argument %s", txt);
-    return port;
+    // built once, by whichever reactor logs a quiz first
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> table(256);
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return table;
+    }();
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
 }
 
-void setReuseAddr(int sock)
+// starts a helper thread with every signal blocked, signals are only handled by the reactors
+template <typename... Args>
+std::thread startHelperThread(Args &&...args)
 {
-    const int one = 1;
-    int res = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
-    if (res)
-        error(1, errno, "setsockopt failed");
-    //int res = setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
-    //if (res)
-    //    error(1, errno, "setsockopt failed");
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    std::thread helper(std::forward<Args>(args)...);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    return helper;
 }
 
-void ctrl_c(int)
+// created quizzes, one record per quiz: u32 body size | u32 crc-32 of the body | quiz body,
+// records are written and synced by a background thread so the reactor never waits on the disk
+class QuizLog
 {
-    std::unique_lock<std::mutex> lock(clientFdsLock);
-
-    startGameCv.notify_all();
-    endGameCv.notify_all();
-    controlQuestionsCv.notify_all();
-
-    for (int clientFd : clientFds)
+private:
+    int fd = -1;
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::string pending;
+    bool stopping = false;
+
+    void run()
     {
-        const char *msg = "Server shut down!\n";
-        if (send(clientFd, msg, strlen(msg) + 1, MSG_DONTWAIT) != (int)strlen(msg) + 1)
+        std::unique_lock<std::mutex> guard(lock);
+        while (true)
         {
-            perror("Server down message error");
+            wakeup.wait(guard, [this] { return stopping || !pending.empty(); });
+            if (pending.empty())
+                return;
+
+            // everything queued meanwhile goes out with one write and one sync
+            std::string batch;
+            batch.swap(pending);
+            guard.unlock();
+            const char *data = batch.data();
+            size_t left = batch.size();
+            while (left > 0)
+            {
+                ssize_t count = write(fd, data, left);
+                if (count == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    perror("Quiz log write error");
+                    break;
+                }
+                data += count;
+                left -= count;
+            }
+            if (fdatasync(fd) == -1)
+                perror("Quiz log sync error");
+            guard.lock();
         }
-        shutdown(clientFd, SHUT_RDWR);
-        close(clientFd);
     }
-    close(servFd);
-    printf("Closing server\n");
-    exit(0);
-}
 
-void clientLoop(int clientFd)
-{
+public:
+    // replays the log into the catalog, cuts off a torn last record and starts the writer
+    bool open(const char *path, QuizCatalog &catalog)
+    {
+        fd = ::open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd == -1)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == -1)
+            return false;
 
-    std::mutex m;
+        size_t valid = 0;
+        int replayed = 0;
+        if (st.st_size > 0)
+        {
+            void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+                return false;
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            const char *log = (const char *)data;
+            while (st.st_size - valid >= 8)
+            {
+                uint32_t size, crc;
+                memcpy(&size, log + valid, 4);
+                memcpy(&crc, log + valid + 4, 4);
+                if (size > st.st_size - valid - 8 || checksum(log + valid + 8, size) != crc)
+                    break;
+                QuizRef quiz = QuizCatalog::decodeQuiz(log + valid + 8, size);
+                if (!quiz)
+                    break;
+                catalog.add(quiz);
+                valid += 8 + size;
+                replayed++;
+            }
+            munmap(data, st.st_size);
+        }
+        if (valid < (size_t)st.st_size)
+        {
+            printf("Dropping %zu bytes of a torn quiz log record\n", st.st_size - valid);
+            if (ftruncate(fd, valid) == -1)
+                return false;
+        }
+        printf("Replayed %d quizzes from %s\n", replayed, path);
 
+        writer = startHelperThread(&QuizLog::run, this);
+        return true;
+    }
 
-    setPlayerNickname(clientFd);
-    printf("%s has connected to the server\n", players_map.find(clientFd)->second.getNickname().c_str());
+    // queues the quiz for the writer, returns right away
+    void append(const Quiz &quiz)
+    {
+        if (fd == -1)
+            return;
+        std::string body;
+        QuizCatalog::encodeQuiz(body, quiz);
+        uint32_t size = body.size();
+        uint32_t crc = checksum(body.data(), body.size());
+
+        std::unique_lock<std::mutex> guard(lock);
+        pending.append((const char *)&size, 4);
+        pending.append((const char *)&crc, 4);
+        pending += body;
+        wakeup.notify_one();
+    }
 
-    // Client menu
-    while (true)
+    // writes what's still queued and stops the writer
+    void close()
     {
-        char menuMsg[] = "MM:=== kahoot menu ===\n1.Host a game.\n2.Join a room\n3.Exit\n";
-        if (send(clientFd, menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
+        if (!writer.joinable())
+            return;
         {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            perror("Send error (menu)");
-            clientFds.erase(clientFd);
-            break;
+            std::unique_lock<std::mutex> guard(lock);
+            stopping = true;
+            wakeup.notify_one();
         }
+        writer.join();
+        ::close(fd);
+        fd = -1;
+    }
+};
 
-        char buffer[MAXLENGTH];
-        memset(buffer, 0, MAXLENGTH);
-        if (read(clientFd, buffer, MAXLENGTH) < 0)
-        {
-            perror("Read error (menu)");
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            clientFds.erase(clientFd);
-            playersConnected--;
-            break;
+class Player
+{
+private:
+    std::string nickname;
+    int playerID = -1;
+    int score = 0;
+    bool waiting = false;
+
+public:
+    Player(int id)
+    {
+        playerID = id;
+        nickname = "player ";
+        nickname += std::to_string(id);
+    }
+    Player()
+    {
+        nickname = "offline";
+    }
+    void addToScore(int amount) { score += amount; }
+
+    std::string getNickname() { return nickname; }
+    int getScore() { return score; }
+    int getPlayerID() { return playerID; }
+    bool getWaiting() { return waiting; }
+
+    void setNickname(std::string nick) { nickname = nick; }
+    void setScore(int scr) { score = scr; }
+    void setPlayerID(int id) { playerID = id; }
+    void setWaiting(bool b) { waiting = b; }
+};
+
+// names a slot map entry, goes stale once the entry is erased
+struct SlotHandle
+{
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    // packs the handle into one ordered, hashable number
+    uint64_t key() const
+    {
+        return (uint64_t)generation << 32 | index;
+    }
+
+    static SlotHandle fromKey(uint64_t key)
+    {
+        return {(uint32_t)key, (uint32_t)(key >> 32)};
+    }
+
+    bool operator==(const SlotHandle &other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+};
+
+template <>
+struct std::hash<SlotHandle>
+{
+    size_t operator()(const SlotHandle &handle) const
+    {
+        return std::hash<uint64_t>()(handle.key());
+    }
+};
+
+// entries in one vector, an erased slot is reused under a new generation so old handles stop resolving
+template <typename T>
+class SlotMap
+{
+private:
+    struct Slot
+    {
+        T value;
+        uint32_t generation = 1;
+        bool used = false;
+    };
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+
+public:
+    SlotHandle insert(T value)
+    {
+        uint32_t index;
+        if (freeSlots.empty())
+        {
+            index = slots.size();
+            slots.emplace_back();
         }
+        else
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        Slot &slot = slots[index];
+        slot.value = std::move(value);
+        slot.used = true;
+        return {index, slot.generation};
+    }
+
+    // the entry or nullptr if the handle is stale, valid until the next insert
+    T *get(SlotHandle handle)
+    {
+        if (handle.index >= slots.size())
+            return nullptr;
+        Slot &slot = slots[handle.index];
+        if (!slot.used || slot.generation != handle.generation)
+            return nullptr;
+        return &slot.value;
+    }
+
+    void erase(SlotHandle handle)
+    {
+        if (!get(handle))
+            return;
+        Slot &slot = slots[handle.index];
+        slot.value = T();
+        slot.used = false;
+        slot.generation++;
+        freeSlots.push_back(handle.index);
+    }
+};
+
+typedef SlotHandle PlayerHandle;
+
+// room members ordered by (-score, index), ties stay apart and a player's rank is O(log n)
+typedef __gnu_pbds::tree<std::pair<int, int>, __gnu_pbds::null_type, std::less<std::pair<int, int>>,
+                         __gnu_pbds::rb_tree_tag, __gnu_pbds::tree_order_statistics_node_update>
+    Ranking;
+
+// where a room is in its game
+enum class GamePhase
+{
+    Lobby,
+    Question,
+    RoundOver,
+    Finished
+};
+
+class Room
+{
+public:
+    PlayerHandle owner;
+    int RoomId;
+    GamePhase phase = GamePhase::Lobby;
+    int round = 0;
+    QuizRef quiz;
+
+    // members in parallel arrays, an index stays the player's for the whole game
+    std::vector<PlayerHandle> members;
+    std::vector<int> scores;
+
+    // letter answeared this round, 0 while the player hasn't answeared
+    std::vector<char> answears;
+    std::vector<int> answearTimes;
+    std::vector<char> connected;
+    std::vector<uint32_t> lobbySeen;
+    std::unordered_map<PlayerHandle, int> memberIndex;
+
+    // connected members and how many of them answeared this round
+    int playerCount = 0;
+    int playerAnswearsCount = 0;
+
+    // current round, points into quiz
+    const Question *question = nullptr;
+    steady_clock::time_point roundStart;
+    steady_clock::time_point roundDeadline;
+
+    // scores of this game, kept ranked as they change
+    Ranking ranking;
+
+    // pending round deadline / lobby expiry / teardown timer (0 if none)
+    uint64_t timer = 0;
+
+    // bumped when the player list changes, lobbySeen is the version each member was sent
+    uint32_t lobbyVersion = 0;
+
+    // the player list changed and is sent to the members after this batch of events
+    bool lobbyInfoPending = false;
+
+    Room(PlayerHandle ownr, int id)
+    {
+        owner = ownr;
+        RoomId = id;
+    }
+
+    bool inGame()
+    {
+        return phase != GamePhase::Lobby;
+    }
+
+    void addPlayer(PlayerHandle player)
+    {
+        memberIndex[player] = members.size();
+        members.push_back(player);
+        scores.push_back(0);
+        answears.push_back(0);
+        answearTimes.push_back(0);
+        connected.push_back(1);
+        lobbySeen.push_back(0);
+        playerCount++;
+    }
+
+    void removePlayer(PlayerHandle player)
+    {
+        auto it = memberIndex.find(player);
+        if (it == memberIndex.end())
+            return;
+        int i = it->second;
+        memberIndex.erase(it);
+        playerCount--;
 
-        // Host menu
-        if (strcmp(buffer, "1\n") == 0)
+        // indexes are only moved before the game, afterwards the player just stays disconnected
+        if (!inGame())
         {
-            char menuMsg[] = "MH:=== kahoot menu ===\n1.Choose a quiz.\n2.Create a quiz set\n3.Go back\n";
-            if (send(clientFd, menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
+            int last = members.size() - 1;
+            if (i != last)
             {
-                std::unique_lock<std::mutex> lock(clientFdsLock);
-                perror("Send error (menu)");
-                clientFds.erase(clientFd);
-                break;
+                members[i] = members[last];
+                lobbySeen[i] = lobbySeen[last];
+                memberIndex[members[i]] = i;
             }
-                if (read(clientFd, buffer, MAXLENGTH) < 0)
-                {
-                    perror("Read error (menu)");
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    clientFds.erase(clientFd);
-                    playersConnected--;
-                    break;
-                }
-            if (strcmp(buffer, "1\n") == 0)
-            {   
-                // creates a room
-                Room r(players_map.find(clientFd)->second);
-
-                // sends a list of available quizzes
-                char menuMsg[4096] = "MH:Choose quiz set number:\n";
-                for (unsigned i = 0; i < quizSet.size(); i++)
-                {
-                    strcat(menuMsg, std::to_string(i + 1).c_str());
-                    strcat(menuMsg, ". ");
-                    strcat(menuMsg, quizSet.at(i).quizTitle.c_str());
-                    strcat(menuMsg, "\n");
-                }
+            members.pop_back();
+            scores.pop_back();
+            answears.pop_back();
+            answearTimes.pop_back();
+            connected.pop_back();
+            lobbySeen.pop_back();
+            return;
+        }
+        if (answears[i])
+            playerAnswearsCount--;
+        connected[i] = 0;
+        ranking.erase({-scores[i], i});
+    }
 
-                memset(buffer, 0, sizeof(buffer));
+    // everyone starts the game with 0 points
+    void resetScores()
+    {
+        std::fill(scores.begin(), scores.end(), 0);
+        ranking.clear();
+        for (int i = 0; i < (int)members.size(); i++)
+            ranking.insert({0, i});
+    }
 
-                // loop until user provides a valid number
-                do
-                {
-                    if (send(clientFd, menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
-                    {
-                        std::unique_lock<std::mutex> lock(clientFdsLock);
-                        perror("Send error (menu)");
-                        clientFds.erase(clientFd);
-                        break;
-                    }
-                    memset(buffer, 0, sizeof(buffer));
-                    if (read(clientFd, buffer, MAXLENGTH) < 0)
-                    {
-                        perror("Read error (menu)");
-                        std::unique_lock<std::mutex> lock(clientFdsLock);
-                        clientFds.erase(clientFd);
-                        playersConnected--;
-                        break;
-                    }
-                } while (atoi(buffer) - 1 >= (int)(quizSet.size()) || atoi(buffer) - 1 < 0);
+    // 1-based place of the player at the index
+    int rankOf(int i)
+    {
+        return ranking.order_of_key({-scores[i], i}) + 1;
+    }
 
+    // starts a new round, returns players who get the question
+    std::vector<PlayerHandle> startRound(const Question &q)
+    {
+        playerAnswearsCount = 0;
+        std::fill(answears.begin(), answears.end(), 0);
+        round++;
+        phase = GamePhase::Question;
+        question = &q;
+        roundStart = steady_clock::now();
+        roundDeadline = roundStart + seconds(q.answearTime);
+
+        std::vector<PlayerHandle> players;
+        for (int i = 0; i < (int)members.size(); i++)
+        {
+            if (connected[i])
+                players.push_back(members[i]);
+        }
+        return players;
+    }
 
+    // records the player's first answear in the current round,
+    // returns how many miliseconds it took or -1 if the answear doesn't count
+    long long addAnswear(PlayerHandle player, char answear, steady_clock::time_point arrived)
+    {
+        if (phase != GamePhase::Question || arrived > roundDeadline)
+            return -1;
+        auto it = memberIndex.find(player);
+        if (it == memberIndex.end() || answears[it->second])
+            return -1;
+        int ms = std::max(0LL, (long long)duration_cast<milliseconds>(arrived - roundStart).count());
+        answears[it->second] = answear;
+        answearTimes[it->second] = ms;
+        playerAnswearsCount++;
+        return ms;
+    }
 
-                r.quiz = quizSet.at(atoi(buffer) - 1);
-                strcpy(menuMsg, "MH:Quiz picked:");
-                strcat(menuMsg, r.quiz.quizTitle.c_str());
-                strcat(menuMsg, "\n");
-                strcat(menuMsg, "Successfully created a room. Room id:");
-                strcat(menuMsg, std::to_string(r.RoomId).c_str());
-                strcat(menuMsg, "\n1.Start the game\n2.Exit\n===Awaiting players===\n");
-                if (send(clientFd, menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
-                {
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    perror("Send error (menu)");
-                    clientFds.erase(clientFd);
-                    break;
-                }
-                strcpy(buffer, "\0");
+    bool allAnsweared()
+    {
+        return playerAnswearsCount >= playerCount;
+    }
 
-                gameRooms.insert(std::pair<int, Room>(r.RoomId, r));
-                do{
-                if (read(clientFd, buffer, MAXLENGTH) < 0)
-                {
-                    perror("Read error (menu)");
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    clientFds.erase(clientFd);
-                    gameRooms.erase(r.RoomId);
-                    playersConnected--;
-                    break;
-                }
-                }while(strcmp(buffer,"1\n")!=0 &&strcmp(buffer,"2\n")!=0);
-                
-                // starts the game
-                if (strcmp(buffer, "1\n") == 0)
-                {
-                    // resets notify variables
-                    notifyFd = 0;
-                    notifyRoomId = 0;
-
-                    // resets player score before the game
-                    for (int playerFd : gameRooms.find(clientFd * 123)->second.playersInRoom)
-                    {
-                        players_map.find(playerFd)->second.setScore(0);
-                    }
-
-                    // sends quiz questions to all players in the room
-                    for (Question q : r.quiz.questions)
-                    {
-                        // sends signal to the host
-                        strcpy(menuMsg, "MH:Round started!\n");
-                        if (send(clientFd, menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
-                        {
-                            std::unique_lock<std::mutex> lock(clientFdsLock);
-                            perror("Send error (menu)");
-                            clientFds.erase(clientFd);
-                            break;
-                        }
-                        notifyRoomMutex.lock();
-                        notifyRoomId = r.RoomId;
-                        startGameCv.notify_all();
-                        notifyRoomMutex.unlock();
-                        gameRooms.find(clientFd * 123)->second.inGame = true;
-                        askQuestion(q, gameRooms.find(clientFd * 123)->second.playersInRoom, clientFd);
-
-                        // waits for all players to answear before starting a new round
-                        std::mutex m4;
-                        std::unique_lock<std::mutex> ul4(m4);
-                        controlQuestionsCv.wait(ul4, [clientFd] {
-                            return (gameRooms.find(123 * clientFd)->second.playerAnswearsCount == gameRooms.find(123 * clientFd)->second.playerCount || notifyFd == -1) ? true : false;
-                        });
-
-                        // sends signal to the host
-                        strcpy(menuMsg, "MH:Round finished!\n");
-                        if (send(clientFd, menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
-                        {
-                            std::unique_lock<std::mutex> lock(clientFdsLock);
-                            perror("Send error (menu)");
-                            clientFds.erase(clientFd);
-                            break;
-                        }
-                    }
-
-                    // sends score boards 
-                    sendScoreBoard(gameRooms.find(clientFd * 123)->second.playersInRoom,clientFd);
-
-                    // resets notify variables
-                    notifyRoomMutex.lock();
-                    notifyFdMutex.lock();
-                    notifyFd = 0;
-                    notifyRoomId = 0;
-                    gameRooms.find(clientFd * 123)->second.inGame = false;
-                    startGameCv.notify_all();
-                    notifyFdMutex.unlock();
-                    notifyRoomMutex.unlock();
-                    endGameCv.notify_all();
-                    //printf("Closing game room ...\n");
-
-                    // Stops for a second so players leave the room before its erased (this is not perfect)
-                    sleep(1);
-                    gameRooms.erase(r.RoomId);
-
-                    if (read(clientFd, buffer, MAXLENGTH) < 0)
-                    {
-                        perror("Read error (menu)");
-                        std::unique_lock<std::mutex> lock(clientFdsLock);
-                        clientFds.erase(clientFd);
-                        gameRooms.erase(r.RoomId);
-                        playersConnected--;
-                        break;
-                    }
-                    strcpy(buffer, "\0");
-                    continue;
-                }
+    // ends the current round and scores it, returns players who didn't answear in time
+    std::vector<PlayerHandle> endRound()
+    {
+        phase = GamePhase::RoundOver;
+
+        // the gains are one branch free pass, only players who scored touch the ranking
+        int n = members.size();
+        char correct = question->correctAnswear.empty() ? 0 : question->correctAnswear[0];
+        int fullTime = 1000 * question->answearTime;
+        std::vector<int> gains(n);
+        for (int i = 0; i < n; i++)
+            gains[i] = (connected[i] & (answears[i] == correct)) * (1000 + (fullTime - answearTimes[i]) / 50);
+        for (int i = 0; i < n; i++)
+        {
+            if (gains[i] == 0)
+                continue;
+            ranking.erase({-scores[i], i});
+            scores[i] += gains[i];
+            ranking.insert({-scores[i], i});
+        }
 
-                // close the game room
-                if (strcmp(buffer, "2\n") == 0)
-                {
-                    printf("MH:Closing game room ...\n");
-                
-                    notifyRoomId = r.RoomId;
-                    gameRooms.find(clientFd * 123)->second.inGame = false;
-                    startGameCv.notify_all();
-                    endGameCv.notify_all();
-
-                    sleep(1);
-                    notifyRoomMutex.lock();
-                    notifyFdMutex.lock();
-                    notifyFd = 0;
-                    notifyRoomId = 0;
-                    gameRooms.find(clientFd * 123)->second.inGame = false;
-                    startGameCv.notify_all();
-                    notifyFdMutex.unlock();
-                    notifyRoomMutex.unlock();
-                    endGameCv.notify_all();
-
-                    gameRooms.erase(r.RoomId);
-                    strcpy(buffer, "\0");
-                    continue;
-                }
-            }
-            
+        std::vector<PlayerHandle> missing;
+        for (int i = 0; i < n; i++)
+        {
+            if (connected[i] && !answears[i])
+                missing.push_back(members[i]);
+        }
+        return missing;
+    }
+};
 
-            // quiz creation menu
-            if (strcmp(buffer, "2\n") == 0)
-            {
-                createQuiz(clientFd);
+// hierarchical timing wheel: LEVELS wheels of SLOTS slots, a slot on level n spans a full turn of level n - 1,
+// timers are cascaded down as the wheel turns so scheduling, cancelling and expiring are all O(1)
+class TimerWheel
+{
+public:
+    typedef std::function<void()> Callback;
 
-                strcpy(buffer, "\0");
-                continue;
-            }
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
 
-            // leave host menu
-            if (strcmp(buffer, "3\n") == 0)
-            {
-                strcpy(buffer, "\0");
-                continue;
-            }
+    struct Timer
+    {
+        uint64_t id;
+        uint64_t expires;
+        Callback callback;
+        std::list<Timer> *slot;
+    };
+
+    milliseconds tick;
+    steady_clock::time_point origin;
+    uint64_t currentTick = 0;
+    uint64_t nextId = 1;
+    std::list<Timer> wheel[LEVELS][SLOTS];
+    std::unordered_map<uint64_t, std::list<Timer>::iterator> timers;
+
+    std::list<Timer> *slotFor(uint64_t expires)
+    {
+        uint64_t diff = expires - currentTick;
+        for (int level = 0; level < LEVELS; level++)
+        {
+            if (diff < (1ULL << (SLOT_BITS * (level + 1))) || level == LEVELS - 1)
+                return &wheel[level][(expires >> (SLOT_BITS * level)) & (SLOTS - 1)];
         }
+        return nullptr;
+    }
 
-        // player menu
-        if (strcmp(buffer, "2\n") == 0)
+    // moves timers of a higher level slot to the levels below, returns the slot index
+    int cascade(int level)
+    {
+        int index = (currentTick >> (SLOT_BITS * level)) & (SLOTS - 1);
+        std::list<Timer> &from = wheel[level][index];
+        while (!from.empty())
         {
-            char menuMsg[] = "MP:=== \"kahoot\" menu ===\nOpen lobbies:\n";
-            if(gameRooms.size() == 0){
-                strcat(menuMsg,"\n");
-            }
-            for (std::map<int, Room>::iterator it = gameRooms.begin(); it != gameRooms.end(); ++it)
+            auto it = from.begin();
+            std::list<Timer> *to = slotFor(it->expires);
+            to->splice(to->end(), from, it);
+            it->slot = to;
+        }
+        return index;
+    }
+
+public:
+    TimerWheel(milliseconds tickLength)
+    {
+        tick = tickLength;
+        origin = steady_clock::now();
+    }
+
+    // calls back after at least delay, returns id for cancel()
+    uint64_t schedule(milliseconds delay, Callback callback)
+    {
+        // the wheel may lag behind if the reactor was idle, count from the real time
+        uint64_t now = duration_cast<milliseconds>(steady_clock::now() - origin).count() / tick.count();
+        uint64_t ticks = (delay.count() + tick.count() - 1) / tick.count() + 1;
+        uint64_t maxTicks = (1ULL << (SLOT_BITS * LEVELS)) - 1 - (now - currentTick);
+        uint64_t expires = now + std::min(ticks, maxTicks);
+
+        std::list<Timer> *slot = slotFor(expires);
+        slot->push_back(Timer{nextId, expires, std::move(callback), slot});
+        timers[nextId] = std::prev(slot->end());
+        return nextId++;
+    }
+
+    // returns false if the timer already fired or was cancelled
+    bool cancel(uint64_t id)
+    {
+        auto it = timers.find(id);
+        if (it == timers.end())
+            return false;
+        it->second->slot->erase(it->second);
+        timers.erase(it);
+        return true;
+    }
+
+    // fires every timer that expired by now
+    void advance(steady_clock::time_point now)
+    {
+        uint64_t target = duration_cast<milliseconds>(now - origin).count() / tick.count();
+        while (currentTick < target)
+        {
+            currentTick++;
+
+            // when a level wraps around, the now due slot of the level above moves down
+            if ((currentTick & (SLOTS - 1)) == 0)
             {
-                strcat(menuMsg,std::to_string(it->second.RoomId).c_str());
-                strcat(menuMsg,"\n");
+                for (int level = 1; level < LEVELS; level++)
+                {
+                    if (cascade(level) != 0)
+                        break;
+                }
             }
-            strcat(menuMsg,"Pass in lobby id:");
-            if (send(clientFd, menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
+
+            // callbacks may schedule and cancel timers, even in this slot
+            std::list<Timer> &due = wheel[0][currentTick & (SLOTS - 1)];
+            while (!due.empty())
             {
-                std::unique_lock<std::mutex> lock(clientFdsLock);
-                perror("Send error (menu)");
-                clientFds.erase(clientFd);
-                break;
+                Callback callback = std::move(due.front().callback);
+                timers.erase(due.front().id);
+                due.pop_front();
+                callback();
             }
-            if (read(clientFd, buffer, MAXLENGTH) < 0)
+        }
+    }
+
+    // miliseconds until advance() may have something to do, -1 if no timers are pending
+    int nextTimeout(steady_clock::time_point now)
+    {
+        if (timers.empty())
+            return -1;
+
+        // the first non-empty slot on level 0, but no later than the next cascade
+        uint64_t ticks = SLOTS - (currentTick & (SLOTS - 1));
+        for (uint64_t i = 1; i < ticks; i++)
+        {
+            if (!wheel[0][(currentTick + i) & (SLOTS - 1)].empty())
             {
-                perror("Read error (menu)");
-                std::unique_lock<std::mutex> lock(clientFdsLock);
-                clientFds.erase(clientFd);
-                playersConnected--;
+                ticks = i;
                 break;
             }
+        }
+        auto wakeup = origin + tick * (long long)(currentTick + ticks);
+        long long wait = duration_cast<milliseconds>(wakeup - now).count() + 1;
+        return wait < 0 ? 0 : wait;
+    }
+};
+
+// splits a client's byte stream into lines, the buffer is only held while bytes are pending
+class LineBuffer
+{
+public:
+    static const size_t CAPACITY = MAXLENGTH;
 
-            bool roomExists = false;
-            Room *currentRoom;
+    // reads as much as fits into the free space, returns what read() would
+    ssize_t readFrom(int fd)
+    {
+        if (!ring)
+            acquire();
+
+        // the free space wraps around the end of the ring at most once
+        size_t tail = (head + size) % CAPACITY;
+        size_t free = CAPACITY - size;
+        struct iovec iov[2];
+        int iovcnt = 1;
+        iov[0].iov_base = ring + tail;
+        iov[0].iov_len = std::min(free, CAPACITY - tail);
+        if (iov[0].iov_len < free)
+        {
+            iov[1].iov_base = ring;
+            iov[1].iov_len = free - iov[0].iov_len;
+            iovcnt = 2;
+        }
+
+        ssize_t count = readv(fd, iov, iovcnt);
+        if (count > 0)
+            size += count;
+        return count;
+    }
 
-            // checks if provided room id is valid
-            for (std::map<int, Room>::iterator it = gameRooms.begin(); it != gameRooms.end(); ++it)
+    // next complete line without its line ending, valid until the buffer is used again
+    bool nextLine(std::string_view &line)
+    {
+        while (true)
+        {
+            size_t length;
+            if (!findNewline(length))
             {
-                if (atoi(buffer) == it->first && it->second.inGame == false)
+                // a line that fills the whole buffer is dropped up to its newline
+                if (size == CAPACITY)
                 {
-                    currentRoom = &it->second;
-                    roomExists = true;
-                    it->second.addPlayer(clientFd);
-                    char menuMsg[MAXLENGTH] = "MH:Player ";
-                    strcat(menuMsg, players_map.find(clientFd)->second.getNickname().c_str());
-                    strcat(menuMsg, " has joined your room !\n");
-                    if (send(it->second.owner.getPlayerID(), menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
-                    {
-                        std::unique_lock<std::mutex> lock(clientFdsLock);
-                        perror("Send error (menu)");
-                        clientFds.erase(it->second.owner.getPlayerID());
-                        break;
-                    }
-                    break;
+                    printf("Dropping overlong line\n");
+                    head = size = scanned = 0;
+                    discarding = true;
                 }
+                return false;
             }
-            if (!roomExists)
+
+            const char *start = ring + head;
+            if (head + length > CAPACITY)
             {
-                char menuMsg[] = "MM:Room does not exist.\n";
-                strcpy(buffer,"\0");
-                if (send(clientFd, menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
-                {
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    perror("Send error (menu)");
-                    clientFds.erase(clientFd);
-                    break;
-                }
+                // the line wraps around, copy it in one piece
+                size_t first = CAPACITY - head;
+                memcpy(scratch, ring + head, first);
+                memcpy(scratch + first, ring, length - first);
+                start = scratch;
             }
+            head = (head + length + 1) % CAPACITY;
+            size -= length + 1;
+            scanned = 0;
 
-            // successfully joined a room
-            else
+            if (discarding)
             {
-                sendLobbyInfo(*currentRoom);
-                /*
-                char menuMsg2[255] = "MP:You have joined the room. Room id:";
-                strcat(menuMsg2, std::to_string(currentRoom->RoomId).c_str());
-                strcat(menuMsg2, "\nQuiz title :");
-                strcat(menuMsg2, currentRoom->quiz.quizTitle.c_str());
-                strcat(menuMsg2, "\nWaiting for the game to start. Type 3 to go back.\n");
-                strcat(menuMsg2, "Players in room:\n");
-                for(int p : currentRoom->playersInRoom){
-                    strcat(menuMsg,players_map.find(p)->second.getNickname().c_str());
-                    strcat(menuMsg2, "\n");
-                }
-                if (send(clientFd, menuMsg2, strlen(menuMsg2) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg2) + 1)
-                {
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    perror("Send error (menu)");
-                    clientFds.erase(clientFd);
-                    break;
-                }
-                */
-                players_map.find(clientFd)->second.setWaiting(true);
+                discarding = false;
+                continue;
+            }
+            if (length > 0 && start[length - 1] == '\r')
+                length--;
+            line = std::string_view(start, length);
+            return true;
+        }
+    }
+
+    // appends up to max pending bytes to out as they are, returns how many were taken
+    size_t take(std::string &out, size_t max)
+    {
+        size_t count = std::min(max, size);
+        if (count == 0)
+            return 0;
+        size_t first = std::min(count, CAPACITY - head);
+        out.append(ring + head, first);
+        out.append(ring, count - first);
+        head = (head + count) % CAPACITY;
+        size -= count;
+        scanned = 0;
+        return count;
+    }
+
+    // gives the memory back once everything was consumed
+    void release()
+    {
+        if (!ring || size != 0)
+            return;
+        if (pool.size() < POOL_LIMIT)
+            pool.push_back(ring);
+        else
+            delete[] ring;
+        ring = nullptr;
+        head = 0;
+    }
+
+    LineBuffer() = default;
+    LineBuffer(const LineBuffer &) = delete;
+    LineBuffer &operator=(const LineBuffer &) = delete;
+
+    // pending bytes go along when a client moves to another reactor
+    LineBuffer(LineBuffer &&other) noexcept
+        : ring(other.ring), head(other.head), size(other.size), scanned(other.scanned), discarding(other.discarding)
+    {
+        other.ring = nullptr;
+        other.head = other.size = other.scanned = 0;
+        other.discarding = false;
+    }
+
+    // and come back if the other reactor could not take the client
+    LineBuffer &operator=(LineBuffer &&other) noexcept
+    {
+        if (this != &other)
+        {
+            delete[] ring;
+            ring = std::exchange(other.ring, nullptr);
+            head = std::exchange(other.head, 0);
+            size = std::exchange(other.size, 0);
+            scanned = std::exchange(other.scanned, 0);
+            discarding = std::exchange(other.discarding, false);
+        }
+        return *this;
+    }
+
+    ~LineBuffer()
+    {
+        delete[] ring;
+    }
+
+private:
+    // idle buffers kept for reuse, so a busy server does not allocate per read, one pool per reactor
+    static const size_t POOL_LIMIT = 1024;
+    static thread_local std::vector<char *> pool;
+
+    // lines wrapping around the end of a ring are joined here
+    static thread_local char scratch[CAPACITY];
+
+    char *ring = nullptr;
+    size_t head = 0;
+    size_t size = 0;
+
+    // pending bytes already known not to contain a newline
+    size_t scanned = 0;
+
+    // set while skipping the rest of an overlong line
+    bool discarding = false;
+
+    void acquire()
+    {
+        if (pool.empty())
+        {
+            ring = new char[CAPACITY];
+            return;
+        }
+        ring = pool.back();
+        pool.pop_back();
+    }
+
+    // length of the first pending line, memchr scans a word or vector at a time
+    bool findNewline(size_t &length)
+    {
+        while (scanned < size)
+        {
+            size_t from = (head + scanned) % CAPACITY;
+            size_t span = std::min(size - scanned, CAPACITY - from);
+            const char *found = (const char *)memchr(ring + from, '\n', span);
+            if (found)
+            {
+                length = scanned + (found - (ring + from));
+                return true;
+            }
+            scanned += span;
+        }
+        return false;
+    }
+};
 
-                std::thread leave(handleLeave, clientFd);
+thread_local std::vector<char *> LineBuffer::pool;
+thread_local char LineBuffer::scratch[LineBuffer::CAPACITY];
+
+// a conversation with one client written top to bottom as a coroutine, every co_await waits for the client's next line
+class Dialogue
+{
+public:
+    struct promise_type
+    {
+        // the line the dialogue is resumed with, empty if it's resumed because its deadline passed
+        std::optional<std::string_view> input;
+
+        Dialogue get_return_object()
+        {
+            return Dialogue(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        // runs up to its first question right away, stays around after the last one until the connection drops it
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    // co_await NextLine{} suspends the dialogue until the reactor hands it a line, the view is valid until the next co_await
+    struct NextLine
+    {
+        promise_type *promise = nullptr;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<promise_type> handle) { promise = &handle.promise(); }
+        std::optional<std::string_view> await_resume() { return promise->input; }
+    };
+
+    Dialogue() = default;
+
+    Dialogue(Dialogue &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    Dialogue &operator=(Dialogue &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    Dialogue(const Dialogue &) = delete;
+    Dialogue &operator=(const Dialogue &) = delete;
+
+    ~Dialogue()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    // the dialogue waits for a line
+    bool active() const
+    {
+        return handle && !handle.done();
+    }
+
+    // runs the dialogue with the line until it waits for the next one or ends
+    void resume(std::string_view line)
+    {
+        handle.promise().input = line;
+        handle.resume();
+    }
+
+    // runs the dialogue with no line, the client missed its deadline
+    void expire()
+    {
+        handle.promise().input.reset();
+        handle.resume();
+    }
+
+private:
+    explicit Dialogue(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// where a connection currently is in the menu / lobby / game flow
+enum class ConnState
+{
+    Nickname,
+    MainMenu,
+    HostMenu,
+    ChooseQuiz,
+    HostLobby,
+    HostGame,
+    JoinRoom,
+    Lobby,
+    InGame,
+    ScoreBoard,
+    CreateQuiz,
+    Upload
+};
+
+class Connection
+{
+public:
+    int fd;
+    ConnState state = ConnState::Nickname;
+
+    // bytes received but not yet split into lines
+    LineBuffer input;
+
+    // the player record of this client
+    PlayerHandle player;
+
+    // room the client hosts or waits in (0 if none)
+    int roomId = 0;
+
+    // reactor the client moves to (-1 if none), with the room it joins or the quiz it hosts over there
+    int handoffTo = -1;
+    int handoffRoom = 0;
+    QuizRef handoffQuiz;
+
+    // page of the lobby list the client is looking at
+    int lobbyPage = 0;
+
+    // set when the client chose to exit
+    bool closing = false;
+
+    // when the last chunk of input arrived
+    steady_clock::time_point lastRead;
+
+    // nickname entry timeout (0 if none)
+    uint64_t timer = 0;
+
+    // frames the socket did not take yet, the first one is partially written
+    std::deque<Frame> output;
+    size_t outputOffset = 0;
+    size_t outputBytes = 0;
+
+    // disconnects the client if it stays above the high-water mark (0 if none)
+    uint64_t slowTimer = 0;
+
+    // set once writing failed, nothing is queued anymore
+    bool broken = false;
+
+    // the client negotiated the binary protocol
+    bool binary = false;
+
+    // catalog the quiz list was sent from, the numbers refer to it even after a reload
+    std::shared_ptr<const QuizCatalog> quizList;
+
+    // search the host typed, the quizzes it found and the page of them on screen
+    std::string quizQuery;
+    std::vector<uint32_t> quizMatches;
+    int quizPage = 0;
+
+    // dialogue the client's lines go to instead of the menus (none if not active)
+    Dialogue dialogue;
+
+    // quiz source sent with UPLOAD and the bytes still missing
+    std::string upload;
+    size_t uploadRemaining = 0;
+
+    Connection(int clientFd)
+    {
+        fd = clientFd;
+    }
+};
+
+// server tunables, set from the command line
+struct ServerConfig
+{
+    size_t outHighWater = OUT_HIGH_WATER;
+    size_t outHardLimit = OUT_HARD_LIMIT;
+    int slowConsumerTimeout = SLOW_CONSUMER_TIMEOUT;
+
+    // quiz bank to serve, or to write when a source file is given
+    const char *bankPath = nullptr;
+    const char *sourcePath = nullptr;
+
+    // log of created quizzes (none if not set)
+    const char *logPath = nullptr;
+
+    // reactor threads, 0 for one per online CPU
+    int reactors = 0;
+
+    // listen backlog and admission limit
+    int backlog = LISTEN_BACKLOG;
+    int maxPendingNicknames = MAX_PENDING_NICKNAMES;
+};
+ServerConfig config;
+
+// every reactor owns the clients it serves and the rooms they host, that state is thread_local
+// and other reactors only reach it by posting to the owner's mailbox
+
+// store player info
+thread_local SlotMap<Player> players;
+
+std::atomic<int> playersConnected{0};
+
+// connection counters of all listeners, printed on SIGUSR1
+struct ListenerStats
+{
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> turnedAway{0};
+    std::atomic<uint64_t> acceptErrors{0};
+
+    // clients that did not pick a nickname yet
+    std::atomic<int> pendingNicknames{0};
+
+    // where the last report left off, only used by the first reactor
+    steady_clock::time_point lastReport = steady_clock::now();
+    uint64_t lastAccepted = 0;
+};
+ListenerStats listenerStats;
+
+// server socket, each reactor listens on its own one bound with SO_REUSEPORT
+thread_local int servFd = -1;
+
+// epoll instance owning the server socket and all client sockets
+thread_local int epollFd;
+
+// all server deadlines, driven by the reactor
+thread_local TimerWheel timers(milliseconds(TIMER_TICK));
+
+// bounded queue any thread can push to and one thread pops from, without locks
+// every cell carries a sequence number telling whose turn it is: pos when free to fill, pos + 1 when filled
+template <typename T>
+class MpscQueue
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    // producers claim positions with a CAS, the consumer owns its own, kept on separate cache lines
+    alignas(64) std::atomic<size_t> enqueuePos{0};
+    alignas(64) size_t dequeuePos = 0;
+
+public:
+    explicit MpscQueue(size_t capacity) : cells(new Cell[capacity]), mask(capacity - 1)
+    {
+        for (size_t i = 0; i < capacity; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // moves the value in, false and untouched if the queue is full
+    bool push(T &value)
+    {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell &cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // takes the oldest value, only the owning thread may call it
+    bool pop(T &value)
+    {
+        Cell &cell = cells[dequeuePos & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != dequeuePos + 1)
+            return false;
+        value = std::move(cell.value);
+        cell.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+        dequeuePos++;
+        return true;
+    }
+};
+
+// a client moving to the reactor that owns the room it joins
+struct Handoff
+{
+    Connection conn;
+    Player player;
+};
+
+// the parts of a reactor other threads may touch
+struct Reactor
+{
+    int listenFd = -1;
+
+    // clients served, new rooms go where there are fewest
+    std::atomic<int> clients{0};
+
+    // wakes the reactor when clients were posted to it
+    int mailFd = -1;
+    MpscQueue<std::unique_ptr<Handoff>> mailbox{MAILBOX_CAPACITY};
+};
+std::unique_ptr<Reactor[]> reactors;
+int reactorCount = 1;
+
+// index of the reactor running on this thread
+thread_local int reactorIndex = 0;
+
+// client sockets
+std::mutex clientFdsLock;
+std::unordered_set<int> clientFds;
+
+// open lobbies of every reactor, the directory is rebuilt from all of them
+std::mutex lobbyLock;
+std::vector<std::vector<std::pair<int, std::string>>> reactorLobbies;
+
+// pre-built pages of the open lobby list, never changed once published
+struct LobbyDirectory
+{
+    std::vector<Frame> text;
+    std::vector<Frame> binary;
+};
+
+// readers take a reference with atomic_load and keep using it while a newer one gets published
+std::shared_ptr<const LobbyDirectory> lobbyDirectory;
+
+// set when a lobby of this reactor opened or closed since the directory was published
+thread_local bool lobbiesChanged = true;
+
+// case-folded nicknames of everyone past the nickname prompt
+std::mutex nicknamesLock;
+std::unordered_set<std::string> nicknames;
+
+// per-client protocol state, keyed by socket
+thread_local std::unordered_map<int, Connection> connections;
+
+// stores game rooms info, a room's code tells which reactor owns it
+thread_local std::unordered_map<int, std::shared_ptr<Room>> gameRooms;
+
+// lobbies of this reactor whose player list changed since it was last sent
+thread_local std::vector<int> pendingLobbyInfo;
+
+// quizzes hosts can pick from, replaced as a whole when the bank is reloaded
+// readers take it with atomic_load and need no lock
+std::shared_ptr<const QuizCatalog> quizSet = std::make_shared<const QuizCatalog>();
+
+// held while a new catalog is published, so two of them don't lose each other's quizzes
+std::mutex catalogLock;
+
+// woken by SIGINT, SIGHUP, SIGUSR1 and by the loader thread once a reloaded bank is ready
+int controlFd = -1;
+volatile sig_atomic_t shutdownRequested = 0;
+
+// set by the first reactor on shutdown, every other reactor then closes its clients and counts itself done
+std::atomic<bool> shuttingDown{false};
+std::atomic<int> reactorsClosed{0};
+volatile sig_atomic_t reloadRequested = 0;
+volatile sig_atomic_t statsRequested = 0;
+
+// set while a loader thread runs, only touched by the first reactor
+bool reloading = false;
+
+// result of the last reload, handed from the loader thread to the reactor
+std::mutex reloadLock;
+bool reloadFinished = false;
+std::shared_ptr<QuizCatalog> reloadedCatalog;
+
+// where created quizzes are kept across restarts
+QuizLog quizLog;
+
+// handles SIGINT, SIGHUP and SIGUSR1, the work is done by the first reactor
+void controlSignal(int sig);
+
+// shuts down if asked to, starts a reload that was asked for, publishes one that finished and prints the counters if asked to
+void handleControl();
+
+// tells the clients, flushes the quiz log and exits
+void shutdownServer();
+
+// tells the clients of this reactor the server is going away, each in its own protocol, and closes them
+void closeClients();
+
+// prints the listener counters and the accept rate since the last report
+void reportStats();
+
+// maps and checks a bank file on its own thread, so lobbies and games never wait for it
+void loadCatalog(const char *bankPath);
+
+// sets up the reactor with the given index on this thread and serves its clients
+void runReactor(int index);
+
+// epoll loop serving all client sockets
+void reactorLoop();
+
+// takes in the clients other reactors handed over
+void handleMail();
+
+// moves the client to the reactor it's headed to, false if it has to stay here
+bool handOff(Connection &conn);
+
+// reactor a new room should run on, this one unless another is clearly less busy
+int placeRoom();
+
+// reactor owning the room code, -1 if it can't be a room code
+int ownerOf(int roomId);
+
+// accepts up to a batch of pending connections, true if more may be waiting
+bool acceptClients();
+
+// reads everything available on the socket and handles each complete line
+void handleReadable(int clientFd);
+
+// advances the client's state machine by one line of input
+void handleLine(Connection &conn, std::string_view line);
+
+// removes the client from its room and closes the socket
+void closeConnection(int clientFd);
+
+// socket of the player, -1 once the player disconnected
+int fdOf(PlayerHandle player);
+
+// sends a message (with the trailing null character) to the client
+bool sendMessage(int clientFd, const std::string &msg);
+
+// queues a frame for the client and writes as much as the socket takes
+bool sendFrame(int clientFd, Frame frame);
+
+// queues whichever form of a message matches the client's protocol
+bool sendFrame(int clientFd, const Frame &text, const Frame &binary);
+
+// encodes a text protocol message for the text or the binary protocol
+Frame encodeMessage(const std::string &msg, bool binary);
+
+// writes queued frames until the socket would block
+void flushOutput(Connection &conn);
+
+// applies the slow consumer policy after the output queue changed
+void checkBackpressure(Connection &conn);
+
+// drops the queued output and shuts the socket down, the reactor closes it
+void dropOutput(Connection &conn);
+
+// sends the main / host / quiz choice / room list menus
+void sendMainMenu(Connection &conn);
+void sendHostMenu(Connection &conn);
+void sendQuizList(Connection &conn);
+void sendRoomList(Connection &conn);
+
+// rebuilds the lobby directory pages and publishes them
+void publishLobbies();
+
+// asks for a nickname until the client picks a free one or the time runs out
+Dialogue nicknameDialogue(Connection &conn);
+
+// takes the nickname and moves the client to the main menu, false if it's not valid
+bool setPlayerNickname(Connection &conn, std::string_view line);
+
+// parses a menu choice or room id, 0 if the line is not a number
+int parseNumber(std::string_view line);
+
+// reserves the nickname, false if it's already taken
+bool claimNickname(std::string_view nickname);
+
+// frees the nickname of a disconnected player
+void releaseNickname(std::string_view nickname);
+
+// nickname as it's stored in the index, so "Bob" and "bob" are the same player
+std::string foldNickname(std::string_view nickname);
+
+// adds a quiz hosts can pick from now on
+void addQuiz(QuizRef quiz);
+
+// asks the host for a quiz question by question and adds it to the catalog
+Dialogue createQuiz(Connection &conn);
+
+// starts receiving a quiz sent as one block after "UPLOAD <bytes>"
+void beginUpload(Connection &conn, std::string_view line);
+
+// adds the uploaded quiz to the catalog once all of it arrived
+void finishUpload(Connection &conn);
+
+// draws a random join code of this reactor no open room uses
+int allocateRoomId();
+
+// puts the client into a lobby of this reactor, or back to the menu if there's none with that code
+void joinRoom(Connection &conn, int roomId);
+
+// opens a lobby of this reactor with the client as its host
+void createRoom(Connection &conn, QuizRef quiz);
+
+// closes a lobby before the game starts and sends its players back to the menu
+void closeRoom(int roomId);
+
+// (re)starts the timer that closes a lobby nobody uses
+void touchLobby(std::shared_ptr<Room> room);
+
+// resets scores and moves the host and players into the game
+void startGame(std::shared_ptr<Room> room);
+
+// asks the next question or ends the game after the last one
+void nextRound(std::shared_ptr<Room> room);
+
+// ends the round when all players answeared or the time ran out
+void endRound(std::shared_ptr<Room> room);
+
+// sends the score board and schedules the room teardown
+void finishGame(std::shared_ptr<Room> room);
+
+// starts a round and sends its question to the players
+void askQuestion(const Question &q, std::shared_ptr<Room> room);
+
+// sends questions to players within one room
+void questionHandler(const Question &q, const std::vector<PlayerHandle> &players);
+
+// determines if the answear is correct and adds up score based on answear speed
+void answearHandler(Connection &conn, std::string_view answear);
+
+// tells the host how the player answeared
+void reportAnswear(int ownerFd, Player &player, bool correct, std::string_view answear, long long ansTime);
+
+// send score board to the players (top 3 players and an individual score and place if the player is not in the top 3)
+void sendScoreBoard(Room &room);
+
+// adds the sample quizzes to the catalog
+void loadSampleQuizzes(QuizCatalog &catalog);
+
+// allows player to leave a lobby before the game starts
+void handleLeave(Connection &conn);
+
+// converts cstring to port
+uint16_t readPort(char *txt);
+
+// parses the command line options into config
+void readOptions(int argc, char **argv);
+
+// converts cstring to a positive number
+long readNumber(char *txt);
+
+// why a quiz title, or a question or answear text, is too long, empty if it fits
+std::string quizTextError(std::string_view text, bool title);
+
+// parses quizzes written one per block: a title line followed by question lines of
+// tab separated text, answears A-D, the correct answear and optionally seconds to answear
+bool parseQuizSource(std::string_view source, std::vector<QuizRef> &quizzes, std::string &error);
+
+// turns a quiz source file into a bank file
+bool compileBank(const char *sourcePath, const char *bankPath);
+
+// sets SO_REUSEADDR and SO_REUSEPORT
+void setReuseAddr(int sock);
+
+// sets O_NONBLOCK
+void setNonBlocking(int sock);
+
+// sends the room's lobby screen to its members once the current batch of events is handled
+void queueLobbyInfo(Room &room);
+
+// sends every queued lobby screen, one message per room however many joined or left
+void sendPendingLobbyInfo();
+
+// lobby screen with the room's player list
+std::string lobbyInfo(Room &room);
+
+// sends the lobby screen to every member who has not seen the current player list
+void sendLobbyInfo(Room &room);
+
+int main(int argc, char **argv)
+{
+
+    // get and validate port number and options
+    readOptions(argc, argv);
+
+    // compiling a quiz bank doesn't start the server
+    if (config.sourcePath)
+        return compileBank(config.sourcePath, config.bankPath) ? 0 : 1;
+    auto port = readPort(argv[optind]);
+
+    // prevent dead sockets from raising pipe signals on write
+    signal(SIGPIPE, SIG_IGN);
+
+    reactorCount = config.reactors ? config.reactors : std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    reactors.reset(new Reactor[reactorCount]);
+    reactorLobbies.resize(reactorCount);
+
+    // one listener per reactor, the kernel spreads new connections over them
+    sockaddr_in serverAddr{.sin_family = AF_INET, .sin_port = htons((short)port), .sin_addr = {INADDR_ANY}};
+    for (int i = 0; i < reactorCount; i++)
+    {
+        // create socket
+        int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd == -1)
+            error(1, errno, "socket failed");
+
+        setReuseAddr(listenFd);
+        setNonBlocking(listenFd);
+
+        // bind to any address and port provided in arguments
+        int res = bind(listenFd, (sockaddr *)&serverAddr, sizeof(serverAddr));
+        if (res)
+            error(1, errno, "bind failed");
+
+        // enter listening mode, a class connecting at once must fit into the queue
+        res = listen(listenFd, config.backlog);
+        if (res)
+            error(1, errno, "listen failed");
+
+        reactors[i].listenFd = listenFd;
+        reactors[i].mailFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (reactors[i].mailFd == -1)
+            error(1, errno, "eventfd failed");
+    }
+
+    printf("Server started.\n");
+
+    printf("Listening  for connections on %d reactors...\n", reactorCount);
+
+    // load sample quizzes
+    auto catalog = std::make_shared<QuizCatalog>();
+    loadSampleQuizzes(*catalog);
+    if (config.bankPath)
+    {
+        if (!catalog->openBank(config.bankPath))
+            error(1, errno, "cannot load quiz bank %s", config.bankPath);
+        printf("Quiz bank with %zu quizzes loaded.\n", catalog->size());
+    }
+    if (config.logPath && !quizLog.open(config.logPath, *catalog))
+        error(1, errno, "cannot open quiz log %s", config.logPath);
+    quizSet = std::move(catalog);
+
+    // graceful ctrl+c exit, SIGHUP reloads the quiz bank while the server keeps running, SIGUSR1 prints the counters
+    controlFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (controlFd == -1)
+        error(1, errno, "eventfd failed");
+    signal(SIGINT, controlSignal);
+    signal(SIGHUP, controlSignal);
+    signal(SIGUSR1, controlSignal);
+
+    // the main thread becomes the first reactor
+    for (int i = 1; i < reactorCount; i++)
+        std::thread(runReactor, i).detach();
+    runReactor(0);
+}
+
+uint16_t readPort(char *txt)
+{
+    char *ptr;
+    auto port = strtol(txt, &ptr, 10);
+    if (*ptr != 0 || port < 1 || (port > ((1 << 16) - 1)))
+        error(1, 0, "illegal argument %s", txt);
+    return port;
+}
+
+void readOptions(int argc, char **argv)
+{
+    const char *usage = "usage: %s <port> [-q high-water bytes] [-Q hard limit bytes] [-s slow consumer seconds] [-b quiz bank] [-l quiz log] [-r reactors]\n"
+                        "       [-L listen backlog] [-N max clients picking a nickname]\n"
+                        "       %s -c quiz source -b quiz bank";
+    int opt;
+    while ((opt = getopt(argc, argv, "q:Q:s:b:c:l:r:L:N:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            config.bankPath = optarg;
+            break;
+        case 'c':
+            config.sourcePath = optarg;
+            break;
+        case 'l':
+            config.logPath = optarg;
+            break;
+        case 'r':
+            config.reactors = readNumber(optarg);
+            break;
+        case 'L':
+            config.backlog = readNumber(optarg);
+            break;
+        case 'N':
+            config.maxPendingNicknames = readNumber(optarg);
+            break;
+        case 'q':
+            config.outHighWater = readNumber(optarg);
+            break;
+        case 'Q':
+            config.outHardLimit = readNumber(optarg);
+            break;
+        case 's':
+            config.slowConsumerTimeout = readNumber(optarg);
+            break;
+        default:
+            error(1, 0, usage, argv[0], argv[0]);
+        }
+    }
+    if (config.sourcePath)
+    {
+        if (!config.bankPath || optind != argc)
+            error(1, 0, usage, argv[0], argv[0]);
+        return;
+    }
+    if (optind != argc - 1)
+        error(1, 0, usage, argv[0], argv[0]);
+    if (config.outHardLimit < config.outHighWater)
+        error(1, 0, "hard limit below the high-water mark");
+}
+
+std::string quizTextError(std::string_view text, bool title)
+{
+    // longer texts would not fit a binary frame once a page of them or a question with its answears is sent
+    if (title && text.size() > QUIZ_TITLE_MAX)
+        return "quiz titles may have up to " + std::to_string(QUIZ_TITLE_MAX) + " characters";
+    if (!title && text.size() > QUIZ_TEXT_MAX)
+        return "questions and answears may have up to " + std::to_string(QUIZ_TEXT_MAX) + " characters";
+    return "";
+}
+
+bool parseQuizSource(std::string_view source, std::vector<QuizRef> &quizzes, std::string &error)
+{
+    Quiz quiz;
+    bool open = false;
+    int lineNo = 0;
+    while (!source.empty())
+    {
+        size_t newline = source.find('\n');
+        std::string_view line = source.substr(0, newline);
+        source.remove_prefix(newline == std::string_view::npos ? source.size() : newline + 1);
+        lineNo++;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.empty())
+            continue;
+
+        std::string_view fields[8];
+        size_t count = 0;
+        while (count < 8)
+        {
+            size_t tab = line.find('\t');
+            fields[count++] = line.substr(0, tab);
+            if (tab == std::string_view::npos)
+                break;
+            line.remove_prefix(tab + 1);
+        }
+
+        // a line without tabs starts the next quiz
+        if (count == 1)
+        {
+            if (open)
+                quizzes.push_back(std::make_shared<const Quiz>(std::move(quiz)));
+            error = quizTextError(fields[0], true);
+            if (!error.empty())
+            {
+                error = "line " + std::to_string(lineNo) + ": " + error;
+                return false;
+            }
+            quiz = Quiz();
+            quiz.quizTitle = fields[0];
+            open = true;
+            continue;
+        }
+        if (!open || count < 6 || count > 7 || fields[5].size() != 1 || fields[5][0] < 'A' || fields[5][0] > 'D')
+        {
+            error = "line " + std::to_string(lineNo) + ": expected a title or a question with 4 answears, the correct one and optionally its time";
+            return false;
+        }
+        for (size_t i = 0; i < 5; i++)
+        {
+            error = quizTextError(fields[i], false);
+            if (!error.empty())
+            {
+                error = "line " + std::to_string(lineNo) + ": " + error;
+                return false;
+            }
+        }
+        int answearTime = ANSWEAR_TIME;
+        if (count == 7 && ((answearTime = parseNumber(fields[6])) < ANSWEAR_TIME_MIN || answearTime > ANSWEAR_TIME_MAX))
+        {
+            error = "line " + std::to_string(lineNo) + ": answear time must be " + std::to_string(ANSWEAR_TIME_MIN) + "-" + std::to_string(ANSWEAR_TIME_MAX) + " seconds";
+            return false;
+        }
+        Question q;
+        q.questionText = fields[0];
+        q.answearA = fields[1];
+        q.answearB = fields[2];
+        q.answearC = fields[3];
+        q.answearD = fields[4];
+        q.correctAnswear = fields[5];
+        q.answearTime = answearTime;
+        quiz.addQuestion(std::move(q));
+    }
+    if (open)
+        quizzes.push_back(std::make_shared<const Quiz>(std::move(quiz)));
+    return true;
+}
+
+bool compileBank(const char *sourcePath, const char *bankPath)
+{
+    std::ifstream in(sourcePath);
+    if (!in)
+    {
+        perror(sourcePath);
+        return false;
+    }
+    std::string source((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<QuizRef> quizzes;
+    std::string error;
+    if (!parseQuizSource(source, quizzes, error))
+    {
+        fprintf(stderr, "%s: %s\n", sourcePath, error.c_str());
+        return false;
+    }
+    if (!QuizCatalog::writeBank(bankPath, quizzes))
+    {
+        perror(bankPath);
+        return false;
+    }
+    printf("Wrote %zu quizzes to %s\n", quizzes.size(), bankPath);
+    return true;
+}
+
+long readNumber(char *txt)
+{
+    char *ptr;
+    auto number = strtol(txt, &ptr, 10);
+    if (*ptr != 0 || number < 1)
+        error(1, 0, "illegal argument %s", txt);
+    return number;
+}
+
+void setReuseAddr(int sock)
+{
+    const int one = 1;
+    int res = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (res)
+        error(1, errno, "setsockopt failed");
+
+    // every reactor binds its own listener to the same port
+    res = setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    if (res)
+        error(1, errno, "setsockopt failed");
+    //int res = setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    //if (res)
+    //    error(1, errno, "setsockopt failed");
+}
+
+void setNonBlocking(int sock)
+{
+    int flags = fcntl(sock, F_GETFL);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+        error(1, errno, "fcntl failed");
+}
+
+void shutdownServer()
+{
+    // the clients of the other reactors are only known to them
+    shuttingDown = true;
+    uint64_t one = 1;
+    for (int i = 1; i < reactorCount; i++)
+    {
+        if (write(reactors[i].mailFd, &one, sizeof(one)) == -1)
+            perror("shutdown wakeup");
+    }
+    closeClients();
+
+    // a reactor stuck on something doesn't keep the server from exiting
+    steady_clock::time_point deadline = steady_clock::now() + milliseconds(SHUTDOWN_GRACE);
+    while (reactorsClosed < reactorCount - 1 && steady_clock::now() < deadline)
+        std::this_thread::sleep_for(milliseconds(1));
+
+    // quizzes created just before still reach the disk
+    quizLog.close();
+    printf("Closing server\n");
+
+    // the other reactors are still running, so globals are not torn down under them
+    fflush(stdout);
+    _exit(0);
+}
+
+void closeClients()
+{
+    for (auto &[clientFd, conn] : connections)
+    {
+        // like before, a client that doesn't take it right away misses it
+        if (!sendMessage(clientFd, "Server shut down!\n") || !conn.output.empty())
+            perror("Server down message error");
+        shutdown(clientFd, SHUT_RDWR);
+        close(clientFd);
+    }
+    close(servFd);
+}
+
+void controlSignal(int sig)
+{
+    int savedErrno = errno;
+    if (sig == SIGINT)
+        shutdownRequested = 1;
+    else if (sig == SIGUSR1)
+        statsRequested = 1;
+    else
+        reloadRequested = 1;
+    uint64_t one = 1;
+    write(controlFd, &one, sizeof(one));
+    errno = savedErrno;
+}
+
+void handleControl()
+{
+    uint64_t count;
+    while (read(controlFd, &count, sizeof(count)) > 0)
+        ;
+    if (shutdownRequested)
+        shutdownServer();
+
+    bool finished;
+    std::shared_ptr<QuizCatalog> next;
+    {
+        std::unique_lock<std::mutex> lock(reloadLock);
+        finished = reloadFinished;
+        reloadFinished = false;
+        next = std::move(reloadedCatalog);
+    }
+    if (statsRequested)
+    {
+        statsRequested = 0;
+        reportStats();
+    }
+    if (finished)
+    {
+        reloading = false;
+        if (next)
+        {
+            // rooms keep the quizzes they picked, the old bank goes away with the last reader
+            std::unique_lock<std::mutex> lock(catalogLock);
+            next->adopt(*quizSet);
+            printf("Quiz bank reloaded, %zu quizzes available.\n", next->size());
+            std::atomic_store(&quizSet, std::shared_ptr<const QuizCatalog>(std::move(next)));
+        }
+    }
+
+    // a request that came in during a reload is served after it
+    if (!reloadRequested || reloading)
+        return;
+    reloadRequested = 0;
+    if (!config.bankPath)
+    {
+        printf("No quiz bank to reload.\n");
+        return;
+    }
+    reloading = true;
+    startHelperThread(loadCatalog, config.bankPath).detach();
+}
+
+void reportStats()
+{
+    steady_clock::time_point now = steady_clock::now();
+    uint64_t accepted = listenerStats.accepted;
+    double elapsed = duration<double>(now - listenerStats.lastReport).count();
+    size_t open;
+    {
+        std::unique_lock<std::mutex> lock(clientFdsLock);
+        open = clientFds.size();
+    }
+    printf("Connections: %llu accepted (%.1f/s over the last %.0f s), %llu turned away busy, %llu accept errors, "
+           "%zu open, %d picking a nickname\n",
+           (unsigned long long)accepted, elapsed > 0 ? (accepted - listenerStats.lastAccepted) / elapsed : 0.0, elapsed,
+           (unsigned long long)listenerStats.turnedAway, (unsigned long long)listenerStats.acceptErrors,
+           open, listenerStats.pendingNicknames.load());
+    printf("Clients per reactor:");
+    for (int i = 0; i < reactorCount; i++)
+        printf(" %d", reactors[i].clients.load());
+    printf("\n");
+    fflush(stdout);
+    listenerStats.lastReport = now;
+    listenerStats.lastAccepted = accepted;
+}
+
+void loadCatalog(const char *bankPath)
+{
+    auto next = std::make_shared<QuizCatalog>();
+    if (!next->openBank(bankPath))
+    {
+        fprintf(stderr, "cannot reload quiz bank %s: %s\n", bankPath, strerror(errno));
+        next = nullptr;
+    }
+    {
+        std::unique_lock<std::mutex> lock(reloadLock);
+        reloadFinished = true;
+        reloadedCatalog = std::move(next);
+    }
+    uint64_t one = 1;
+    if (write(controlFd, &one, sizeof(one)) == -1)
+        perror("reload wakeup");
+}
+
+void runReactor(int index)
+{
+    reactorIndex = index;
+    servFd = reactors[index].listenFd;
+
+    // a reactor per core, so its connections and rooms stay in that core's caches
+    if (reactorCount > 1)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)), &cpus);
+        int res = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (res)
+            error(0, res, "cannot pin reactor %d", index);
+    }
+
+    epollFd = epoll_create1(0);
+    if (epollFd == -1)
+        error(1, errno, "epoll_create1 failed");
+
+    epoll_event ee{};
+    ee.events = EPOLLIN | EPOLLET;
+    ee.data.fd = servFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, servFd, &ee))
+        error(1, errno, "epoll_ctl failed");
+    ee.data.fd = reactors[index].mailFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, ee.data.fd, &ee))
+        error(1, errno, "epoll_ctl failed");
+
+    // reloads and reports are run by the first reactor
+    ee.data.fd = controlFd;
+    if (index == 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, controlFd, &ee))
+        error(1, errno, "epoll_ctl failed");
+
+    reactorLoop();
+}
+
+void reactorLoop()
+{
+    epoll_event events[MAXEVENTS];
+
+    // edge triggered, so a listener left with connections after a batch is not reported again
+    bool acceptPending = false;
+    while (true)
+    {
+        int timeout = acceptPending ? 0 : timers.nextTimeout(steady_clock::now());
+        int n = epoll_wait(epollFd, events, MAXEVENTS, timeout);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            error(1, errno, "epoll_wait failed");
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == servFd)
+            {
+                acceptPending = true;
+                continue;
+            }
+            if (fd == controlFd)
+            {
+                handleControl();
+                continue;
+            }
+            if (fd == reactors[reactorIndex].mailFd)
+            {
+                handleMail();
+                continue;
+            }
+
+            if (events[i].events & (EPOLLHUP | EPOLLERR))
+            {
+                closeConnection(fd);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                auto it = connections.find(fd);
+                if (it != connections.end())
+                    flushOutput(it->second);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+                handleReadable(fd);
+        }
+
+        // new clients are taken after the connected ones were served
+        if (acceptPending)
+            acceptPending = acceptClients();
+
+        timers.advance(steady_clock::now());
+
+        // one rebuild per batch of events, no matter how many rooms changed
+        if (lobbiesChanged)
+            publishLobbies();
+        if (!pendingLobbyInfo.empty())
+            sendPendingLobbyInfo();
+    }
+}
+
+void handleMail()
+{
+    Reactor &self = reactors[reactorIndex];
+    uint64_t count;
+    while (read(self.mailFd, &count, sizeof(count)) > 0)
+        ;
+    if (shuttingDown)
+    {
+        // the first reactor exits the process once everyone was told
+        closeClients();
+        reactorsClosed++;
+        while (true)
+            pause();
+    }
+
+    std::unique_ptr<Handoff> handoff;
+    while (self.mailbox.pop(handoff))
+    {
+        int clientFd = handoff->conn.fd;
+        connections.erase(clientFd);
+        Connection &conn = connections.emplace(clientFd, std::move(handoff->conn)).first->second;
+        conn.player = players.insert(std::move(handoff->player));
+        self.clients++;
+        int roomId = conn.handoffRoom;
+        QuizRef quiz = std::move(conn.handoffQuiz);
+        conn.handoffTo = -1;
+        conn.handoffRoom = 0;
+
+        epoll_event ee{};
+        ee.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ee.data.fd = clientFd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &ee))
+        {
+            perror("epoll_ctl failed");
+            closeConnection(clientFd);
+            continue;
+        }
+        if (quiz)
+            createRoom(conn, std::move(quiz));
+        else
+            joinRoom(conn, roomId);
+
+        // output the old reactor did not get out yet, then lines sent after the room id
+        flushOutput(conn);
+        handleReadable(clientFd);
+    }
+}
+
+bool handOff(Connection &conn)
+{
+    int clientFd = conn.fd;
+    Reactor &owner = reactors[conn.handoffTo];
+
+    // the owner registers the socket again, timers start over there
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, clientFd, nullptr);
+    if (conn.timer)
+    {
+        timers.cancel(conn.timer);
+        conn.timer = 0;
+    }
+    if (conn.slowTimer)
+    {
+        timers.cancel(conn.slowTimer);
+        conn.slowTimer = 0;
+    }
+    PlayerHandle player = conn.player;
+    std::unique_ptr<Handoff> handoff(new Handoff{std::move(conn), std::move(*players.get(player))});
+    if (!owner.mailbox.push(handoff))
+    {
+        // the owner is swamped, the client stays here and may try again
+        *players.get(player) = std::move(handoff->player);
+        conn = std::move(handoff->conn);
+        conn.handoffTo = -1;
+        conn.handoffRoom = 0;
+        conn.handoffQuiz = nullptr;
+
+        epoll_event ee{};
+        ee.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ee.data.fd = clientFd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &ee))
+        {
+            perror("epoll_ctl failed");
+            conn.closing = true;
+            return false;
+        }
+        sendMessage(clientFd, "MM:Server busy, retry in " + std::to_string(BUSY_RETRY_DELAY) + " ms\n");
+        sendMainMenu(conn);
+        return false;
+    }
+    players.erase(player);
+    connections.erase(clientFd);
+    reactors[reactorIndex].clients--;
+
+    uint64_t one = 1;
+    if (write(owner.mailFd, &one, sizeof(one)) == -1)
+        perror("handoff wakeup");
+    return true;
+}
+
+int placeRoom()
+{
+    int best = reactorIndex;
+    int bestLoad = reactors[reactorIndex].clients - ROOM_PLACEMENT_SLACK;
+    for (int i = 0; i < reactorCount; i++)
+    {
+        int load = reactors[i].clients;
+        if (load < bestLoad)
+        {
+            best = i;
+            bestLoad = load;
+        }
+    }
+    return best;
+}
+
+int ownerOf(int roomId)
+{
+    if (roomId < ROOM_CODE_MIN || roomId > ROOM_CODE_MAX)
+        return -1;
+    return roomId % reactorCount;
+}
+
+bool acceptClients()
+{
+    for (int batch = 0; batch < ACCEPT_BATCH; batch++)
+    {
+        // prepare placeholders for client address
+        sockaddr_in clientAddr{};
+        socklen_t clientAddrSize = sizeof(clientAddr);
+
+        // accept new connection, already non-blocking
+        auto clientFd = accept4(servFd, (sockaddr *)&clientAddr, &clientAddrSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientFd == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return false;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            listenerStats.acceptErrors++;
+            perror("accept failed");
+            return false;
+        }
+        listenerStats.accepted++;
+
+        // past the admission limit the client gets an answer right away instead of a stalled prompt
+        if (listenerStats.pendingNicknames++ >= config.maxPendingNicknames)
+        {
+            listenerStats.pendingNicknames--;
+            listenerStats.turnedAway++;
+            static const std::string busyMsg = "Server busy, retry in " + std::to_string(BUSY_RETRY_DELAY) + " ms\n";
+            if (send(clientFd, busyMsg.c_str(), busyMsg.size() + 1, MSG_DONTWAIT) == -1)
+                perror("Server busy message error");
+            close(clientFd);
+            continue;
+        }
+
+        // add client to all clients set
+        {
+            std::unique_lock<std::mutex> lock(clientFdsLock);
+            clientFds.insert(clientFd);
+        }
+
+        // tell who has connected
+        printf("new connection from: %s:%hu (fd: %d)\n", inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port), clientFd);
+
+        // create a new player
+        connections.erase(clientFd);
+        Connection &conn = connections.try_emplace(clientFd, clientFd).first->second;
+        conn.player = players.insert(Player(clientFd));
+        reactors[reactorIndex].clients++;
+
+        epoll_event ee{};
+        // edge triggered EPOLLOUT only fires when a full socket drains, so it stays registered
+        ee.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ee.data.fd = clientFd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &ee))
+        {
+            perror("epoll_ctl failed");
+            closeConnection(clientFd);
+            continue;
+        }
+
+        conn.dialogue = nicknameDialogue(conn);
+    }
+
+    // more may be waiting, edge triggered epoll won't say so again
+    return true;
+}
+
+void handleReadable(int clientFd)
+{
+    auto it = connections.find(clientFd);
+    if (it == connections.end())
+        return;
+    Connection &conn = it->second;
+
+    // edge triggered, so the socket has to be drained
+    bool closed = false;
+    while (true)
+    {
+        // handle every complete line, the connection can go away while doing so
+        std::string_view line;
+        while (!closed && conn.handoffTo == -1)
+        {
+            if (conn.state == ConnState::Upload)
+            {
+                // an uploaded quiz is raw bytes, not lines
+                conn.uploadRemaining -= conn.input.take(conn.upload, conn.uploadRemaining);
+                if (conn.uploadRemaining > 0)
+                    break;
+                finishUpload(conn);
+            }
+            else if (conn.input.nextLine(line))
+                handleLine(conn, line);
+            else
+                break;
+            closed = conn.closing;
+        }
+
+        // what follows a move to another reactor is read over there
+        if (!closed && conn.handoffTo != -1)
+        {
+            if (handOff(conn))
+                return;
+
+            // the other reactor was busy, the lines after the room id are handled here
+            closed = conn.closing;
+            continue;
+        }
+        if (closed)
+            break;
+
+        ssize_t count = conn.input.readFrom(clientFd);
+        if (count > 0)
+        {
+            // answear time is measured from when the data arrived
+            conn.lastRead = steady_clock::now();
+            continue;
+        }
+        if (count == 0)
+        {
+            closed = true;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            perror("Read error (menu)");
+            closed = true;
+        }
+        break;
+    }
+    conn.input.release();
+
+    if (closed)
+        closeConnection(clientFd);
+}
+
+void handleLine(Connection &conn, std::string_view line)
+{
+    if (conn.dialogue.active())
+    {
+        conn.dialogue.resume(line);
+        if (!conn.dialogue.active())
+            conn.dialogue = Dialogue();
+        return;
+    }
+
+    switch (conn.state)
+    {
+
+    // Client menu
+    case ConnState::MainMenu:
+        if (line == "1")
+            sendHostMenu(conn);
+        else if (line == "2")
+        {
+            conn.lobbyPage = 0;
+            sendRoomList(conn);
+        }
+        else if (line == "3")
+        {
+            // leave player menu
+            conn.closing = true;
+        }
+        else
+            sendMainMenu(conn);
+        break;
+
+    // Host menu
+    case ConnState::HostMenu:
+        if (line == "1")
+        {
+            conn.quizList = nullptr;
+            conn.quizQuery.clear();
+            conn.quizMatches = {};
+            conn.quizPage = 0;
+            sendQuizList(conn);
+        }
+        else if (line == "2")
+        {
+            // quiz creation menu
+            conn.state = ConnState::CreateQuiz;
+            conn.dialogue = createQuiz(conn);
+        }
+        else if (line.substr(0, 7) == "UPLOAD ")
+            beginUpload(conn, line);
+        else
+            sendMainMenu(conn);
+        break;
+
+    case ConnState::ChooseQuiz:
+    {
+        // flips through the list or narrows it down
+        if (line == "n" || line == "p")
+        {
+            conn.quizPage += line == "n" ? 1 : -1;
+            sendQuizList(conn);
+            break;
+        }
+        if (!line.empty() && line[0] == '/')
+        {
+            conn.quizQuery = line.substr(1);
+            conn.quizMatches = conn.quizQuery.empty() ? std::vector<uint32_t>() : conn.quizList->find(conn.quizQuery);
+            conn.quizPage = 0;
+            sendQuizList(conn);
+            break;
+        }
+
+        // loop until user provides a valid number
+        int choice = parseNumber(line);
+        QuizRef quiz;
+        if (!conn.quizQuery.empty())
+        {
+            if (choice >= 1 && choice <= (int)conn.quizMatches.size())
+                quiz = conn.quizList->get(conn.quizMatches[choice - 1]);
+        }
+        else if (choice >= 1 && choice <= (int)conn.quizList->size())
+            quiz = conn.quizList->get(choice - 1);
+        if (!quiz)
+        {
+            sendQuizList(conn);
+            break;
+        }
+        conn.quizList = nullptr;
+        conn.quizMatches = {};
+
+        // a busy reactor passes new games on, running ones stay where their players are
+        int target = placeRoom();
+        if (target != reactorIndex)
+        {
+            conn.handoffTo = target;
+            conn.handoffQuiz = std::move(quiz);
+            break;
+        }
+        createRoom(conn, std::move(quiz));
+        break;
+    }
+
+    case ConnState::HostLobby:
+    {
+        auto room = gameRooms.find(conn.roomId);
+        if (room == gameRooms.end())
+        {
+            sendMainMenu(conn);
+            break;
+        }
+
+        // starts the game
+        if (line == "1")
+            startGame(room->second);
+
+        // close the game room
+        else if (line == "2")
+        {
+            closeRoom(conn.roomId);
+            sendMainMenu(conn);
+        }
+        break;
+    }
+
+    // the host watches the game
+    case ConnState::HostGame:
+        break;
+
+    // player menu
+    case ConnState::JoinRoom:
+    {
+        // flips through the lobby list
+        if (line == "n" || line == "p")
+        {
+            conn.lobbyPage += line == "n" ? 1 : -1;
+            sendRoomList(conn);
+            break;
+        }
+
+        // the room lives on another reactor, the client follows it there
+        int roomId = parseNumber(line);
+        int owner = ownerOf(roomId);
+        if (owner != -1 && owner != reactorIndex)
+        {
+            conn.handoffTo = owner;
+            conn.handoffRoom = roomId;
+            break;
+        }
+        joinRoom(conn, roomId);
+        break;
+    }
+
+    // waits for the host to start the game
+    case ConnState::Lobby:
+        if (line == "3")
+            handleLeave(conn);
+        break;
+
+    case ConnState::InGame:
+        answearHandler(conn, line);
+        break;
+
+    // waits for player to finish watching scoreboard
+    case ConnState::ScoreBoard:
+        sendMainMenu(conn);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void closeConnection(int clientFd)
+{
+    auto it = connections.find(clientFd);
+    if (it == connections.end())
+        return;
+    Connection &conn = it->second;
+
+    auto room = gameRooms.find(conn.roomId);
+    if (room != gameRooms.end())
+    {
+        std::shared_ptr<Room> r = room->second;
+        if (conn.state == ConnState::HostLobby)
+            closeRoom(conn.roomId);
+        else if (conn.state == ConnState::Lobby)
+            handleLeave(conn);
+        else if (conn.state == ConnState::InGame)
+        {
+            // a host that left simply has a stale handle, the game goes on without it
+            r->removePlayer(conn.player);
+
+            // the others may only be waiting for this player
+            if (r->phase == GamePhase::Question && r->allAnsweared())
+                endRound(r);
+        }
+    }
+    if (conn.state == ConnState::Nickname)
+        listenerStats.pendingNicknames--;
+    else
+    {
+        playersConnected--;
+        releaseNickname(players.get(conn.player)->getNickname());
+    }
+    players.erase(conn.player);
+    if (conn.timer)
+        timers.cancel(conn.timer);
+
+    // last messages like timeouts get one more chance to go out
+    flushOutput(conn);
+    if (conn.slowTimer)
+        timers.cancel(conn.slowTimer);
+
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, clientFd, nullptr);
+    connections.erase(it);
+    reactors[reactorIndex].clients--;
+
+    // disconnects player from the server
+    {
+        std::unique_lock<std::mutex> lock(clientFdsLock);
+        clientFds.erase(clientFd);
+    }
+    shutdown(clientFd, SHUT_RDWR);
+    close(clientFd);
+    printf("Ending service for client %d\n", clientFd);
+}
+
+int fdOf(PlayerHandle player)
+{
+    Player *p = players.get(player);
+    return p ? p->getPlayerID() : -1;
+}
+
+bool sendMessage(int clientFd, const std::string &msg)
+{
+    if (clientFd < 0)
+        return false;
+
+    auto it = connections.find(clientFd);
+    if (it == connections.end())
+        return false;
+    return sendFrame(clientFd, encodeMessage(msg, it->second.binary));
+}
+
+Frame encodeMessage(const std::string &msg, bool binary)
+{
+    if (!binary)
+    {
+        // the client splits messages on the null character
+        auto frame = std::make_shared<std::string>();
+        frame->reserve(msg.size() + 1);
+        *frame = msg;
+        frame->push_back('\0');
+        return frame;
+    }
+
+    // the prefix of a text message becomes the frame type
+    std::string_view text = msg;
+    Op op = Op::Text;
+    size_t prefix = 0;
+    if (text.substr(0, 6) == "MM:===")
+        op = Op::MainMenu, prefix = 3;
+    else if (text.substr(0, 3) == "MM:")
+        op = Op::MenuNotice, prefix = 3;
+    else if (text.substr(0, 15) == "MH:Quiz created")
+        op = Op::HostNotice, prefix = 3;
+    else if (text.substr(0, 3) == "MH:")
+        op = Op::HostMenu, prefix = 3;
+    else if (text.substr(0, 3) == "MP:")
+        op = Op::PlayerMenu, prefix = 3;
+    else if (text.substr(0, 2) == "S:")
+        op = Op::ScoreBoard, prefix = 2;
+    return binaryFrame(op, text.substr(prefix));
+}
+
+Frame binaryFrame(Op op, std::string_view payload)
+{
+    // the length field has 16 bits, a longer message is not sent at all rather than cut
+    if (payload.size() > 0xFFFF)
+    {
+        fprintf(stderr, "Refusing a %zu byte binary message (type %d), frames carry at most 65535 bytes\n", payload.size(), (int)op);
+        return nullptr;
+    }
+    auto frame = std::make_shared<std::string>();
+    frame->reserve(payload.size() + 3);
+    frame->push_back((char)op);
+    frame->push_back((char)(payload.size() >> 8));
+    frame->push_back((char)(payload.size() & 0xFF));
+    frame->append(payload);
+    return frame;
+}
+
+bool sendFrame(int clientFd, const Frame &text, const Frame &binary)
+{
+    auto it = connections.find(clientFd);
+    if (it == connections.end())
+        return false;
+    return sendFrame(clientFd, it->second.binary ? binary : text);
+}
+
+bool sendFrame(int clientFd, Frame frame)
+{
+    if (!frame)
+        return false;
+    auto it = connections.find(clientFd);
+    if (it == connections.end() || it->second.broken)
+        return false;
+    Connection &conn = it->second;
+
+    conn.outputBytes += frame->size();
+    conn.output.push_back(std::move(frame));
+
+    // only the first frame can be written right away, the rest waits for EPOLLOUT
+    if (conn.output.size() == 1)
+        flushOutput(conn);
+    else
+        checkBackpressure(conn);
+    return !conn.broken;
+}
+
+void flushOutput(Connection &conn)
+{
+    while (!conn.output.empty() && !conn.broken)
+    {
+        iovec iov[OUT_BATCH];
+        int iovcnt = 0;
+        size_t offset = conn.outputOffset;
+        for (auto &frame : conn.output)
+        {
+            if (iovcnt == OUT_BATCH)
+                break;
+            iov[iovcnt].iov_base = (char *)frame->data() + offset;
+            iov[iovcnt].iov_len = frame->size() - offset;
+            iovcnt++;
+            offset = 0;
+        }
+
+        ssize_t count = writev(conn.fd, iov, iovcnt);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            perror("Send error");
+            dropOutput(conn);
+            return;
+        }
+
+        // pop what was written completely, remember how far the next frame got
+        conn.outputBytes -= count;
+        size_t written = conn.outputOffset + count;
+        while (!conn.output.empty() && written >= conn.output.front()->size())
+        {
+            written -= conn.output.front()->size();
+            conn.output.pop_front();
+        }
+        conn.outputOffset = written;
+    }
+    checkBackpressure(conn);
+}
+
+void checkBackpressure(Connection &conn)
+{
+    if (conn.broken)
+        return;
+
+    if (conn.outputBytes > config.outHardLimit)
+    {
+        printf("Client %d exceeded the output limit\n", conn.fd);
+        dropOutput(conn);
+        return;
+    }
+
+    // bursts above the high-water mark are fine as long as the client catches up
+    if (conn.outputBytes > config.outHighWater)
+    {
+        if (conn.slowTimer)
+            return;
+        int clientFd = conn.fd;
+        conn.slowTimer = timers.schedule(seconds(config.slowConsumerTimeout), [clientFd] {
+            auto it = connections.find(clientFd);
+            if (it == connections.end())
+                return;
+            it->second.slowTimer = 0;
+            printf("Client %d is too slow\n", clientFd);
+            dropOutput(it->second);
+        });
+    }
+    else if (conn.slowTimer)
+    {
+        timers.cancel(conn.slowTimer);
+        conn.slowTimer = 0;
+    }
+}
+
+void dropOutput(Connection &conn)
+{
+    conn.broken = true;
+    conn.output.clear();
+    conn.outputOffset = 0;
+    conn.outputBytes = 0;
+    if (conn.slowTimer)
+    {
+        timers.cancel(conn.slowTimer);
+        conn.slowTimer = 0;
+    }
+    printf("removing %d\n", conn.fd);
+    shutdown(conn.fd, SHUT_RDWR);
+}
+
+void sendMainMenu(Connection &conn)
+{
+    conn.state = ConnState::MainMenu;
+    conn.roomId = 0;
+    sendMessage(conn.fd, "MM:=== kahoot menu ===\n1.Host a game.\n2.Join a room\n3.Exit\n");
+}
+
+void sendHostMenu(Connection &conn)
+{
+    conn.state = ConnState::HostMenu;
+    sendMessage(conn.fd, "MH:=== kahoot menu ===\n1.Choose a quiz.\n2.Create a quiz set\n3.Go back\n");
+}
 
-                // waits for the host to start the game
-                std::mutex m2;
-                std::unique_lock<std::mutex> lock1(m2);
-                startGameCv.wait(lock1, [currentRoom, clientFd] { return (currentRoom->RoomId == notifyRoomId || notifyFd == clientFd) ? true : false; });
+void sendQuizList(Connection &conn)
+{
+    // the host pages through the catalog they first saw, or through what their search found
+    if (!conn.quizList)
+        conn.quizList = std::atomic_load(&quizSet);
+    bool searching = !conn.quizQuery.empty();
+    size_t count = searching ? conn.quizMatches.size() : conn.quizList->size();
+    int pages = std::max<int>(1, (count + QUIZ_PAGE_SIZE - 1) / QUIZ_PAGE_SIZE);
+    conn.quizPage = std::clamp(conn.quizPage, 0, pages - 1);
+
+    std::string menuMsg = "MH:Choose quiz set number:\n";
+    if (searching)
+    {
+        menuMsg += "Titles with \"";
+        menuMsg += conn.quizQuery;
+        menuMsg += "\":\n";
+    }
+    size_t end = std::min(count, (size_t)(conn.quizPage + 1) * QUIZ_PAGE_SIZE);
+    for (size_t i = conn.quizPage * QUIZ_PAGE_SIZE; i < end; i++)
+    {
+        menuMsg += std::to_string(i + 1);
+        menuMsg += ". ";
+        menuMsg += conn.quizList->title(searching ? conn.quizMatches[i] : i);
+        menuMsg += "\n";
+    }
+    if (conn.quizPage + 1 < pages)
+        menuMsg += "n.Next page\n";
+    if (conn.quizPage > 0)
+        menuMsg += "p.Previous page\n";
+    menuMsg += "/text.Search titles and #tags (/ lists all)\n";
+    menuMsg += "Page " + std::to_string(conn.quizPage + 1) + "/" + std::to_string(pages) + ", " + std::to_string(count);
+    menuMsg += searching && count == QUIZ_SEARCH_LIMIT ? " quizzes shown, search for more to narrow it down\n" : " quizzes\n";
+    conn.state = ConnState::ChooseQuiz;
+    sendMessage(conn.fd, menuMsg);
+}
 
-                // takes player back to main menu if they decide to leave
-                if (players_map.find(clientFd)->second.getWaiting() == false)
-                {
+void sendRoomList(Connection &conn)
+{
+    std::shared_ptr<const LobbyDirectory> directory = std::atomic_load(&lobbyDirectory);
+    if (!directory)
+    {
+        publishLobbies();
+        directory = std::atomic_load(&lobbyDirectory);
+    }
 
-                    currentRoom->removePlayer(clientFd);
-                    printf("MH:Player has left the room\n");
-                    char menuMsg[MAXLENGTH] = "Player ";
-                    strcat(menuMsg, players_map.find(clientFd)->second.getNickname().c_str());
-                    strcat(menuMsg, " has left your room !\n");
-                    sendLobbyInfo(*currentRoom);
-                    if (send(currentRoom->owner.getPlayerID(), menuMsg, strlen(menuMsg) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg) + 1)
-                    {
-                        std::unique_lock<std::mutex> lock(clientFdsLock);
-                        perror("Send error (menu)");
-                        clientFds.erase(currentRoom->owner.getPlayerID());
-                        break;
-                    }
-
-                    notifyFdMutex.lock();
-                    notifyFd = 0;
-                    notifyRoomId = 0;
-                    startGameCv.notify_all();
-                    notifyFdMutex.unlock();
-                    leave.join();
-                    continue;
-                }
-                players_map.find(clientFd)->second.setWaiting(false);
-                leave.join();
+    int pages = directory->text.size();
+    conn.lobbyPage = std::clamp(conn.lobbyPage, 0, pages - 1);
+    conn.state = ConnState::JoinRoom;
+    sendFrame(conn.fd, directory->text[conn.lobbyPage], directory->binary[conn.lobbyPage]);
+}
 
-                printf("Game has started for player %d!\n", clientFd);
+void publishLobbies()
+{
+    std::vector<std::pair<int, std::string>> own;
+    for (auto &room : gameRooms)
+    {
+        if (!room.second->inGame())
+            own.push_back({room.first, room.second->quiz->quizTitle});
+    }
 
-                // waits for the game to end
-                std::mutex m3;
-                std::unique_lock<std::mutex> ul2(m3);
-                endGameCv.wait(ul2, [currentRoom] { return (currentRoom->inGame == false) ? true : false; });
-                printf("Game has ended for player %d!\n", clientFd);
+    // each reactor publishes the whole directory, the lock keeps an older one from replacing a newer one
+    std::unique_lock<std::mutex> lock(lobbyLock);
+    reactorLobbies[reactorIndex] = std::move(own);
+    std::vector<std::pair<int, const std::string *>> lobbies;
+    for (auto &list : reactorLobbies)
+    {
+        for (auto &lobby : list)
+            lobbies.push_back({lobby.first, &lobby.second});
+    }
+    std::sort(lobbies.begin(), lobbies.end());
 
-                // waits for player to finish watching scoreboard
-                if (read(clientFd, buffer, MAXLENGTH) < 0)
-                {
-                    perror("Read error (menu)");
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    clientFds.erase(clientFd);
-                    playersConnected--;
-                    break;
-                }
-                strcpy(buffer, "\0");
-                notifyFd = 0;
-            }
+    auto directory = std::make_shared<LobbyDirectory>();
+    int pages = std::max<int>(1, (lobbies.size() + LOBBY_PAGE_SIZE - 1) / LOBBY_PAGE_SIZE);
+    for (int page = 0; page < pages; page++)
+    {
+        std::string menuMsg = "MP:=== \"kahoot\" menu ===\nOpen lobbies";
+        if (pages > 1)
+        {
+            menuMsg += " (page ";
+            menuMsg += std::to_string(page + 1);
+            menuMsg += "/";
+            menuMsg += std::to_string(pages);
+            menuMsg += ")";
         }
-        // leave player menu
-        if (strcmp(buffer, "3\n") == 0)
+        menuMsg += ":\n";
+        if (lobbies.empty())
+            menuMsg += "\n";
+        size_t end = std::min(lobbies.size(), (size_t)(page + 1) * LOBBY_PAGE_SIZE);
+        for (size_t i = page * LOBBY_PAGE_SIZE; i < end; i++)
         {
-            break;
+            menuMsg += std::to_string(lobbies[i].first);
+            menuMsg += " ";
+            menuMsg += *lobbies[i].second;
+            menuMsg += "\n";
         }
+        if (page + 1 < pages)
+            menuMsg += "n.Next page\n";
+        if (page > 0)
+            menuMsg += "p.Previous page\n";
+        menuMsg += "Pass in lobby id:";
+        directory->text.push_back(encodeMessage(menuMsg, false));
+        directory->binary.push_back(encodeMessage(menuMsg, true));
     }
 
-    // disconnects player from the server
-    shutdown(clientFd, SHUT_RDWR);
-    close(clientFd);
-    clientFds.erase(clientFd);
-    printf("Ending service for client %d\n", clientFd);
+    std::atomic_store(&lobbyDirectory, std::shared_ptr<const LobbyDirectory>(std::move(directory)));
+    lobbiesChanged = false;
 }
 
-void setPlayerNickname(int clientFd)
+Dialogue nicknameDialogue(Connection &conn)
 {
-    const char *msg1 = "Choose your nickname:\n";
-    if (send(clientFd, msg1, strlen(msg1) + 1, MSG_DONTWAIT) != (int)strlen(msg1) + 1)
-    {
-        std::unique_lock<std::mutex> lock(clientFdsLock);
-        perror("nickname setup message failed");
-        clientFds.erase(clientFd);
-    }
-    char buffer[MAXLENGTH];
-    decltype(clientFds) bad;
+    int clientFd = conn.fd;
+    sendMessage(clientFd, "Choose your nickname:\n");
+
+    // don't let half-open connections hold a socket forever
+    conn.timer = timers.schedule(seconds(NICKNAME_TIMEOUT), [clientFd] {
+        auto it = connections.find(clientFd);
+        if (it == connections.end() || !it->second.dialogue.active())
+            return;
+        it->second.timer = 0;
+        it->second.dialogue.expire();
+        closeConnection(clientFd);
+    });
+
     while (true)
     {
-        memset(buffer, 0, sizeof(buffer));
-        // TODO: deal with buffer overflow
-        if (read(clientFd, buffer, MAXLENGTH) > 0)
+        std::optional<std::string_view> line = co_await Dialogue::NextLine{};
+        if (!line)
         {
-            // Swapping '\n' for a null character
-            buffer[strlen(buffer) - 1] = '\0';
-            int r = strlen(buffer);
-            if (validNickname(buffer) && r <= 16 && r >= 3)
-            {
-                players_map.find(clientFd)->second.setNickname(buffer);
-                const char *msg = "Nickname set !\n";
-                if (send(clientFd, msg, strlen(msg) + 1, MSG_DONTWAIT) != (int)strlen(msg) + 1)
-                {
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    perror("Nickname set message failed");
-                    clientFds.erase(clientFd);
-                }
-                playersConnected++;
-                break;
-            }
-            else if (r < 3)
-            {
-                const char *msg = "Nickname too short ! Try something with at least 3 characters:\n";
-                if (send(clientFd, msg, strlen(msg) + 1, MSG_DONTWAIT) != (int)strlen(msg) + 1)
-                {
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    perror("Nickname setup message failed");
-                    clientFds.erase(clientFd);
-                }
-            }
-            else if (r > 16)
-            {
-                const char *msg = "Nickname too long ! Try something below 16 characters:\n";
-                if (send(clientFd, msg, strlen(msg) + 1, MSG_DONTWAIT) != (int)strlen(msg) + 1)
-                {
-                    perror("Nickname setup message failed");
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    clientFds.erase(clientFd);
-                }
-            }
-            else
-            {
-                const char *msg = "Nickname already taken ! Try something different:\n";
-                if (send(clientFd, msg, strlen(msg) + 1, MSG_DONTWAIT) != (int)strlen(msg) + 1)
-                {
-                    perror("Nickname setup message failed");
-                    std::unique_lock<std::mutex> lock(clientFdsLock);
-                    clientFds.erase(clientFd);
-                }
-            }
+            sendMessage(clientFd, "Nickname timeout !\n");
+            co_return;
         }
-
-        else
+        if (*line == BINARY_HELLO && !conn.binary)
         {
-            printf("Client %d has disconnected !\n", clientFd);
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            clientFds.erase(clientFd);
-            break;
+            // acknowledged in text, everything after it is binary
+            sendMessage(clientFd, BINARY_HELLO);
+            conn.binary = true;
+            continue;
         }
+        if (setPlayerNickname(conn, *line))
+            co_return;
     }
 }
 
-bool validNickname(std::string nickname)
+bool setPlayerNickname(Connection &conn, std::string_view line)
 {
-    for (int i : clientFds)
+    int clientFd = conn.fd;
+    int r = line.size();
+    if (r < 3)
     {
-        // return false if name is already taken
-        if (nickname == players_map.find(i)->second.getNickname().c_str())
-        {
-            return false;
-        }
+        sendMessage(clientFd, "Nickname too short ! Try something with at least 3 characters:\n");
     }
-    return true;
+    else if (r > 16)
+    {
+        sendMessage(clientFd, "Nickname too long ! Try something below 16 characters:\n");
+    }
+    else if (!claimNickname(line))
+    {
+        sendMessage(clientFd, "Nickname already taken ! Try something different:\n");
+    }
+    else
+    {
+        players.get(conn.player)->setNickname(std::string(line));
+        timers.cancel(conn.timer);
+        conn.timer = 0;
+        sendMessage(clientFd, "Nickname set !\n");
+        listenerStats.pendingNicknames--;
+        playersConnected++;
+        printf("%.*s has connected to the server\n", (int)line.size(), line.data());
+        sendMainMenu(conn);
+        return true;
+    }
+    return false;
 }
 
-void askQuestion(Question q, std::unordered_set<int> players, int ownerFd)
+int parseNumber(std::string_view line)
 {
-    gameRooms.find(123 * ownerFd)->second.playerAnswearsCount = 0;
-    questionHandler(q, players);
-    answearHandler(q, players, ownerFd);
-}
-
-void questionHandler(Question q, std::unordered_set<int> players)
-{
-    int res;
-    //std::unique_lock<std::mutex> lock(clientFdsLock);
-    decltype(players) bad;
-    for (int clientFd : players)
-    {
-        //printf("Question handler loop playerfd : %d\n",clientFd);
-        char msg[MAXLENGTH] = "Q:";
-        strcat(msg, q.questionText.c_str());
-        strcat(msg, "\nA: ");
-        strcat(msg, q.answearA.c_str());
-        strcat(msg, "\nB: ");
-        strcat(msg, q.answearB.c_str());
-        strcat(msg, "\nC: ");
-        strcat(msg, q.answearC.c_str());
-        strcat(msg, "\nD: ");
-        strcat(msg, q.answearD.c_str());
-        strcat(msg, "\n");
-        int count = strlen(msg);
-        //printf("Size of question : %d\n", count);
-        res = send(clientFd, msg, count, MSG_DONTWAIT);
-        if (res != count)
-            bad.insert(clientFd);
-    }
-    for (int clientFd : bad)
-    {
-        printf("removing %d\n", clientFd);
-        clientFds.erase(clientFd);
-        players.erase(clientFd);
-        close(clientFd);
-    }
+    int number = 0;
+    if (std::from_chars(line.data(), line.data() + line.size(), number).ec != std::errc())
+        return 0;
+    return number;
 }
 
-void answearHandler(Question q, std::unordered_set<int> players_set, int ownerFd)
+bool claimNickname(std::string_view nickname)
 {
-    auto start = high_resolution_clock::now();
-    for (int clientFd : players_set)
-    {
-        std::thread([clientFd, q, ownerFd, start] {
-            char buff[MAXLENGTH] = "\0";
+    // checking and taking the name is one step
+    std::string folded = foldNickname(nickname);
+    std::unique_lock<std::mutex> lock(nicknamesLock);
+    return nicknames.insert(std::move(folded)).second;
+}
 
-            auto stop = high_resolution_clock::now();
-            auto duration = duration_cast<seconds>(stop - start);
-            while (duration.count() < q.answearTime)
-            {
-                if (recv(clientFd, buff, MAXLENGTH, MSG_DONTWAIT) > 0)
-                {
-                    break;
-                }
-                stop = high_resolution_clock::now();
-                duration = duration_cast<seconds>(stop - start);
-                sleep(0.1);
-            }
-            auto ansTime = duration_cast<microseconds>(stop - start) / 1000;
+void releaseNickname(std::string_view nickname)
+{
+    std::string folded = foldNickname(nickname);
+    std::unique_lock<std::mutex> lock(nicknamesLock);
+    nicknames.erase(folded);
+}
 
-            buff[strlen(buff) - 1] = '\0';
-            if (strcmp(buff, q.correctAnswear.c_str()) == 0)
-            {
-                char msg[MAXLENGTH] = "\0";
-                strcat(msg, "MH:Player ");
-                strcat(msg, players_map.find(clientFd)->second.getNickname().c_str());
-                strcat(msg, " has answeared correctly in ");
-                strcat(msg, std::to_string(ansTime.count()).c_str());
-                strcat(msg, " miliseconds\n");
-                int count = strlen(msg);
-                int res = send(ownerFd, msg, count, MSG_DONTWAIT);
-                if (res != count)
-                {
-                    printf("removing %d\n", clientFd);
-                    clientFds.erase(clientFd);
-                    players_map.erase(clientFd);
-                    close(clientFd);
-                }
-                int score = 1000 + (1000 * q.answearTime - ansTime.count()) / 50;
-                players_map.find(clientFd)->second.addToScore(score);
-                printf("MH:Player %s answeared correctly\n", players_map.find(clientFd)->second.getNickname().c_str());
-            }
-            else
-            {
-                char msg[MAXLENGTH] = "MH:";
-                strcat(msg, "Player ");
-                strcat(msg, players_map.find(clientFd)->second.getNickname().c_str());
-                strcat(msg, " gave a wrong answear( ");
-                strcat(msg,buff);
-                strcat(msg, ")\n");
-                int count = strlen(msg);
-                int res = send(ownerFd, msg, count, MSG_DONTWAIT);
-                if (res != count)
-                {
-                    printf("removing %d\n", clientFd);
-                    clientFds.erase(clientFd);
-                    close(clientFd);
-                }
-                //printf("Player %s gave a wrong answear\n",players[clientFd].getNickname().c_str());
-            }
-            //printf("Question answearing thread ended for player %d\n",clientFd);
-            gameRooms.find(123 * ownerFd)->second.playerAnswearsCount++;
-            notifyFd = clientFd;
-            controlQuestionsCv.notify_all();
-        }).detach();
-    }
+std::string foldNickname(std::string_view nickname)
+{
+    std::string folded(nickname);
+    for (char &c : folded)
+        c = tolower((unsigned char)c);
+    return folded;
+}
+
+void addQuiz(QuizRef quiz)
+{
+    // quizzes are added rarely, the copy shares the bank and only repeats the in-memory part
+    std::unique_lock<std::mutex> lock(catalogLock);
+    auto next = std::make_shared<QuizCatalog>(*quizSet);
+    next->add(std::move(quiz));
+    std::atomic_store(&quizSet, std::shared_ptr<const QuizCatalog>(std::move(next)));
 }
 
-void handleLeave(int clientFd)
+Dialogue createQuiz(Connection &conn)
 {
-    char buffer[MAXLENGTH] = "";
-    while (players_map.find(clientFd)->second.getWaiting())
+    int clientFd = conn.fd;
+    const std::string anotherMsg = "MH:Create another question - type \"1\"\nFinish quiz - type \"2\"\n";
+
+    // the host has no deadline, so every line that comes back is a real one
+    Quiz quiz;
+    sendMessage(clientFd, "MH:Enter quiz title: \n");
+    std::string_view title = *co_await Dialogue::NextLine{};
+    for (std::string error; !(error = quizTextError(title, true)).empty(); title = *co_await Dialogue::NextLine{})
+        sendMessage(clientFd, "MH:" + error + ", enter a shorter one:\n");
+    quiz.quizTitle = title;
+    while (true)
     {
-        recv(clientFd, buffer, MAXLENGTH, MSG_DONTWAIT);
-        if (strcmp(buffer, "3\n") == 0)
+        Question question;
+        std::string createQuizMsg = "MH:Enter question text (question no. ";
+        createQuizMsg += std::to_string(quiz.questions.size() + 1);
+        createQuizMsg += ")\n";
+        const std::pair<std::string, std::string *> prompts[] = {
+            {createQuizMsg, &question.questionText},
+            {"MH:Enter answear A text:\n", &question.answearA},
+            {"MH:Enter answear B text:\n", &question.answearB},
+            {"MH:Enter answear C text:\n", &question.answearC},
+            {"MH:Enter answear D text:\n", &question.answearD}};
+        for (const auto &[prompt, field] : prompts)
+        {
+            sendMessage(clientFd, prompt);
+            std::string_view text = *co_await Dialogue::NextLine{};
+            for (std::string error; !(error = quizTextError(text, false)).empty(); text = *co_await Dialogue::NextLine{})
+                sendMessage(clientFd, "MH:" + error + ", enter a shorter one:\n");
+            *field = text;
+        }
+
+        sendMessage(clientFd, "MH:Which answear is correct? (A,B,C,D)\n");
+        std::string_view correct = *co_await Dialogue::NextLine{};
+        while (correct != "A" && correct != "B" && correct != "C" && correct != "D")
+            correct = *co_await Dialogue::NextLine{};
+        question.correctAnswear = correct;
+
+        // questions entered one by one get the default time, uploads can set their own
+        question.answearTime = ANSWEAR_TIME;
+        quiz.addQuestion(std::move(question));
+
+        sendMessage(clientFd, anotherMsg);
+        std::string_view choice = *co_await Dialogue::NextLine{};
+        while (choice != "1" && choice != "2")
         {
-            players_map.find(clientFd)->second.setWaiting(false);
-            notifyFdMutex.lock();
-            notifyRoomMutex.lock();
-            notifyFd = clientFd;
-            notifyRoomId = 0;
-            startGameCv.notify_all();
-            notifyFdMutex.unlock();
-            notifyRoomMutex.unlock();
+            sendMessage(clientFd, anotherMsg);
+            choice = *co_await Dialogue::NextLine{};
         }
-        sleep(1);
+        if (choice == "2")
+            break;
     }
+
+    quizLog.append(quiz);
+    addQuiz(std::make_shared<const Quiz>(std::move(quiz)));
+    sendMessage(clientFd, "MH:Quiz created!\n");
+    sendMainMenu(conn);
 }
 
-void sendScoreBoard(std::unordered_set<int> playersInRoom,int owner)
+void beginUpload(Connection &conn, std::string_view line)
 {
-    std::map<int, int> playerScores;
-    char scoreBoardMsg[MAXLENGTH] = "S:Scoreboard:\n";
-
-    // sort player fd's by their score
-    for (int clientFd : playersInRoom)
+    int bytes = parseNumber(line.substr(7));
+    if (bytes <= 0 || bytes > UPLOAD_LIMIT)
     {
-        // make score negative so the map sorts it in descending order
-        playerScores.insert(std::pair<int, int>(-players_map.find(clientFd)->second.getScore(), clientFd));
+        sendMessage(conn.fd, "MH:Upload size must be 1-" + std::to_string(UPLOAD_LIMIT) + " bytes\n");
+        sendHostMenu(conn);
+        return;
     }
-    int count = 1;
-    int lastScore;
-    for (std::pair<int, int> p : playerScores)
+
+    // no prompt, the quiz follows the command right away
+    conn.upload.clear();
+    conn.upload.reserve(bytes);
+    conn.uploadRemaining = bytes;
+    conn.state = ConnState::Upload;
+}
+
+void finishUpload(Connection &conn)
+{
+    std::vector<QuizRef> quizzes;
+    std::string error;
+    if (!parseQuizSource(conn.upload, quizzes, error))
+        error = "MH:Upload rejected, " + error + "\n";
+    else if (quizzes.size() != 1 || quizzes[0]->questions.empty())
+        error = "MH:Upload rejected, expected one quiz with at least one question\n";
+    std::string().swap(conn.upload);
+    if (!error.empty())
     {
+        sendMessage(conn.fd, error);
+        sendHostMenu(conn);
+        return;
+    }
 
-        strcat(scoreBoardMsg, std::to_string(count).c_str());
-        strcat(scoreBoardMsg, ". ");
-        strcat(scoreBoardMsg, players_map.find(p.second)->second.getNickname().c_str());
-        strcat(scoreBoardMsg, " ");
-        strcat(scoreBoardMsg, std::to_string(players_map.find(p.second)->second.getScore()).c_str());
-        strcat(scoreBoardMsg, " points\n");
-        lastScore = players_map.find(p.second)->second.getScore();
-        count++;
-        if (count > 3)
-            break;
+    quizLog.append(*quizzes[0]);
+    addQuiz(quizzes[0]);
+    sendMessage(conn.fd, "MH:Quiz created! (" + std::to_string(quizzes[0]->questions.size()) + " questions)\n");
+    sendMainMenu(conn);
+}
+
+int allocateRoomId()
+{
+    // codes must not be guessable from the host's socket or the previous room
+    static thread_local std::random_device random;
+    std::uniform_int_distribution<int> code(ROOM_CODE_MIN, ROOM_CODE_MAX);
+    int roomId;
+    do
+        roomId = code(random);
+    while (ownerOf(roomId) != reactorIndex || gameRooms.count(roomId));
+    return roomId;
+}
+
+void createRoom(Connection &conn, QuizRef quiz)
+{
+    auto r = std::make_shared<Room>(conn.player, allocateRoomId());
+    r->quiz = std::move(quiz);
+    std::string menuMsg = "MH:Quiz picked:";
+    menuMsg += r->quiz->quizTitle;
+    menuMsg += "\n";
+    menuMsg += "Successfully created a room. Room id:";
+    menuMsg += std::to_string(r->RoomId);
+    menuMsg += "\n1.Start the game\n2.Exit\n===Awaiting players===\n";
+    gameRooms[r->RoomId] = r;
+    lobbiesChanged = true;
+    conn.roomId = r->RoomId;
+    conn.state = ConnState::HostLobby;
+    sendMessage(conn.fd, menuMsg);
+    touchLobby(r);
+}
+
+void joinRoom(Connection &conn, int roomId)
+{
+    // checks if provided room id is valid
+    auto it = gameRooms.find(roomId);
+    if (it == gameRooms.end() || it->second->inGame())
+    {
+        sendMessage(conn.fd, "MM:Room does not exist.\n");
+        sendMainMenu(conn);
+        return;
     }
-    if (send(owner, scoreBoardMsg, strlen(scoreBoardMsg) + 1, MSG_DONTWAIT) != (int)strlen(scoreBoardMsg) + 1)
+
+    // successfully joined a room
+    Player &player = *players.get(conn.player);
+    it->second->addPlayer(conn.player);
+    std::string menuMsg = "MH:Player ";
+    menuMsg += player.getNickname();
+    menuMsg += " has joined your room !\n";
+    sendMessage(fdOf(it->second->owner), menuMsg);
+
+    conn.roomId = it->first;
+    conn.state = ConnState::Lobby;
+    player.setWaiting(true);
+
+    // the joiner sees the lobby right away, the others with the next batch
+    Room &room = *it->second;
+    queueLobbyInfo(room);
+    sendMessage(conn.fd, lobbyInfo(room));
+    room.lobbySeen[room.memberIndex[conn.player]] = room.lobbyVersion;
+    touchLobby(it->second);
+}
+
+void closeRoom(int roomId)
+{
+    auto room = gameRooms.find(roomId);
+    if (room == gameRooms.end())
+        return;
+    printf("MH:Closing game room ...\n");
+
+    for (PlayerHandle handle : room->second->members)
+    {
+        auto player = connections.find(fdOf(handle));
+        if (player != connections.end() && player->second.roomId == roomId)
         {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            perror("send error (score board)");
-            clientFds.erase(owner);
+            players.get(handle)->setWaiting(false);
+            sendMainMenu(player->second);
         }
-    for (int clientFd : playersInRoom)
-    {
+    }
+    if (room->second->timer)
+        timers.cancel(room->second->timer);
+    gameRooms.erase(room);
+    lobbiesChanged = true;
+}
 
-        if (send(clientFd, scoreBoardMsg, strlen(scoreBoardMsg) + 1, MSG_DONTWAIT) != (int)strlen(scoreBoardMsg) + 1)
+void touchLobby(std::shared_ptr<Room> room)
+{
+    if (room->timer)
+        timers.cancel(room->timer);
+
+    std::weak_ptr<Room> weak = room;
+    room->timer = timers.schedule(seconds(LOBBY_IDLE_TIMEOUT), [weak] {
+        std::shared_ptr<Room> room = weak.lock();
+        if (!room || room->phase != GamePhase::Lobby)
+            return;
+        room->timer = 0;
+
+        auto host = connections.find(fdOf(room->owner));
+        closeRoom(room->RoomId);
+        if (host != connections.end() && host->second.roomId == room->RoomId)
         {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            perror("send error (score board)");
-            clientFds.erase(clientFd);
+            sendMessage(host->first, "MH:Room closed due to inactivity.\n");
+            sendMainMenu(host->second);
         }
-        if (players_map.find(clientFd)->second.getScore() < lastScore)
-        {
-            char yourScoreMsg[MAXLENGTH] = "MH:Your score: ";
-            strcat(yourScoreMsg, std::to_string(players_map.find(clientFd)->second.getScore()).c_str());
-            strcat(yourScoreMsg, " points\n");
+    });
+}
 
-            if (send(clientFd, yourScoreMsg, strlen(yourScoreMsg) + 1, MSG_DONTWAIT) != (int)strlen(yourScoreMsg) + 1)
-            {
-                std::unique_lock<std::mutex> lock(clientFdsLock);
-                perror("send error (score board)");
-                clientFds.erase(clientFd);
-            }
-        }
+void startGame(std::shared_ptr<Room> room)
+{
+    if (room->timer)
+        timers.cancel(room->timer);
+    room->timer = 0;
+
+    // a started game is no longer listed
+    lobbiesChanged = true;
+
+    auto host = connections.find(fdOf(room->owner));
+    if (host != connections.end())
+        host->second.state = ConnState::HostGame;
+
+    // resets player score before the game
+    for (PlayerHandle handle : room->members)
+    {
+        Player &player = *players.get(handle);
+        auto conn = connections.find(player.getPlayerID());
+        if (conn != connections.end())
+            conn->second.state = ConnState::InGame;
+        player.setWaiting(false);
+        printf("Game has started for player %d!\n", player.getPlayerID());
     }
+    room->resetScores();
+
+    nextRound(room);
 }
 
-void createQuiz(int clientFd)
+void nextRound(std::shared_ptr<Room> room)
 {
-    char createQuizMsg[] = "MH:Enter quiz title: \n";
-    Quiz quiz;
-
-    if (send(clientFd, createQuizMsg, strlen(createQuizMsg) + 1, MSG_DONTWAIT) != (int)strlen(createQuizMsg) + 1)
+    if (room->round >= (int)room->quiz->questions.size())
     {
-        std::unique_lock<std::mutex> lock(clientFdsLock);
-        perror("Send error (menu)");
-        clientFds.erase(clientFd);
+        finishGame(room);
+        return;
     }
-    char buffer[MAXLENGTH];
-    memset(buffer, 0, MAXLENGTH);
-    int count = read(clientFd, buffer, MAXLENGTH);
-    if (count < 0)
+    const Question &q = room->quiz->questions.at(room->round);
+
+    // sends signal to the host
+    sendMessage(fdOf(room->owner), "MH:Round started!\n");
+
+    askQuestion(q, room);
+
+    // the round ends early once everyone answeared
+    std::weak_ptr<Room> weak = room;
+    room->timer = timers.schedule(seconds(q.answearTime), [weak] {
+        std::shared_ptr<Room> room = weak.lock();
+        if (!room)
+            return;
+        room->timer = 0;
+        endRound(room);
+    });
+}
+
+void endRound(std::shared_ptr<Room> room)
+{
+    if (room->phase != GamePhase::Question)
+        return;
+    if (room->timer)
+        timers.cancel(room->timer);
+    room->timer = 0;
+
+    int clientFd = fdOf(room->owner);
+    for (PlayerHandle player : room->endRound())
     {
-        perror("Read error (menu)");
-        std::unique_lock<std::mutex> lock(clientFdsLock);
-        clientFds.erase(clientFd);
-        playersConnected--;
+        reportAnswear(clientFd, *players.get(player), false, "", 0);
     }
-    buffer[count - 1] = '\0';
-    quiz.quizTitle = buffer;
-    //printf("%s\n",quiz.quizTitle.c_str());
-    int questionCount = 0;
 
-    do
+    // sends signal to the host
+    sendMessage(clientFd, "MH:Round finished!\n");
+
+    nextRound(room);
+}
+
+void finishGame(std::shared_ptr<Room> room)
+{
+    int roomId = room->RoomId;
+    int clientFd = fdOf(room->owner);
+
+    // sends score boards
+    sendScoreBoard(*room);
+
+    // players and the host go back to the menu after watching the score board
+    room->phase = GamePhase::Finished;
+    for (PlayerHandle handle : room->members)
     {
-        Question newQuestion;
-        questionCount++;
-        char createQuizMsg[MAXLENGTH] = "MH:Enter question text (question no. ";
-        strcat(createQuizMsg, std::to_string(questionCount).c_str());
-        strcat(createQuizMsg, ")\n");
-        if (send(clientFd, createQuizMsg, strlen(createQuizMsg) + 1, MSG_DONTWAIT) != (int)strlen(createQuizMsg) + 1)
-        {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            perror("Send error (menu)");
-            clientFds.erase(clientFd);
-        }
-        memset(buffer, 0, 4096);
-        count = read(clientFd, buffer, 4096);
-        if (count < 0)
+        int playerFd = fdOf(handle);
+        auto player = connections.find(playerFd);
+        if (player != connections.end() && player->second.roomId == roomId)
         {
-            perror("Read error (menu)");
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            clientFds.erase(clientFd);
-            playersConnected--;
+            player->second.state = ConnState::ScoreBoard;
+            player->second.roomId = 0;
+            printf("Game has ended for player %d!\n", playerFd);
         }
-        buffer[count - 1] = '\0';
-        newQuestion.questionText = buffer;
+    }
+    auto host = connections.find(clientFd);
+    if (host != connections.end() && host->second.roomId == roomId)
+    {
+        host->second.state = ConnState::ScoreBoard;
+        host->second.roomId = 0;
+    }
 
-        strcpy(createQuizMsg, "MH:Enter answear A text:\n");
-        if (send(clientFd, createQuizMsg, strlen(createQuizMsg) + 1, MSG_DONTWAIT) != (int)strlen(createQuizMsg) + 1)
-        {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            perror("Send error (menu)");
-            clientFds.erase(clientFd);
-        }
-        memset(buffer, 0, 4096);
-        count = read(clientFd, buffer, 4096);
-        if (count < 0)
-        {
-            perror("Read error (menu)");
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            clientFds.erase(clientFd);
-            playersConnected--;
-        }
-        buffer[count - 1] = '\0';
-        newQuestion.answearA = buffer;
+    // the id may already belong to a new room of the same host by then
+    std::weak_ptr<Room> weak = room;
+    room->timer = timers.schedule(seconds(ROOM_TEARDOWN_DELAY), [weak, roomId] {
+        std::shared_ptr<Room> room = weak.lock();
+        auto it = gameRooms.find(roomId);
+        if (room && it != gameRooms.end() && it->second == room)
+            gameRooms.erase(it);
+    });
+}
 
-        strcpy(createQuizMsg, "MH:Enter answear B text:\n");
-        if (send(clientFd, createQuizMsg, strlen(createQuizMsg) + 1, MSG_DONTWAIT) != (int)strlen(createQuizMsg) + 1)
-        {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            perror("Send error (menu)");
-            clientFds.erase(clientFd);
-        }
-        memset(buffer, 0, 4096);
-        count = read(clientFd, buffer, 4096);
-        if (count < 0)
-        {
-            perror("Read error (menu)");
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            clientFds.erase(clientFd);
-            playersConnected--;
-        }
-        buffer[count - 1] = '\0';
-        newQuestion.answearB = buffer;
+void askQuestion(const Question &q, std::shared_ptr<Room> room)
+{
+    std::vector<PlayerHandle> players = room->startRound(q);
+    questionHandler(q, players);
+}
 
-        strcpy(createQuizMsg, "MH:Enter answear C text:\n");
-        if (send(clientFd, createQuizMsg, strlen(createQuizMsg) + 1, MSG_DONTWAIT) != (int)strlen(createQuizMsg) + 1)
-        {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            perror("Send error (menu)");
-            clientFds.erase(clientFd);
-        }
-        memset(buffer, 0, 4096);
-        count = read(clientFd, buffer, 4096);
-        if (count < 0)
-        {
-            perror("Read error (menu)");
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            clientFds.erase(clientFd);
-            playersConnected--;
-        }
-        buffer[count - 1] = '\0';
-        newQuestion.answearC = buffer;
+void questionHandler(const Question &q, const std::vector<PlayerHandle> &players)
+{
+    // every player gets the same pre-built frame
+    for (PlayerHandle player : players)
+        sendFrame(fdOf(player), q.frame, q.binary);
+}
 
-        strcpy(createQuizMsg, "MH:Enter answear D text:\n");
-        if (send(clientFd, createQuizMsg, strlen(createQuizMsg) + 1, MSG_DONTWAIT) != (int)strlen(createQuizMsg) + 1)
-        {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            perror("Send error (menu)");
-            clientFds.erase(clientFd);
-        }
-        memset(buffer, 0, 4096);
-        count = read(clientFd, buffer, 4096);
-        if (count < 0)
-        {
-            perror("Read error (menu)");
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            clientFds.erase(clientFd);
-            playersConnected--;
-        }
-        buffer[count - 1] = '\0';
-        newQuestion.answearD = buffer;
+void answearHandler(Connection &conn, std::string_view answear)
+{
+    auto room = gameRooms.find(conn.roomId);
+    if (room == gameRooms.end())
+        return;
+
+    std::shared_ptr<Room> r = room->second;
+    // anything but a single A-D letter is a wrong answear, stored as '?' since 0 marks a player who didn't answear
+    char choice = answear.size() == 1 && answear[0] >= 'A' && answear[0] <= 'D' ? answear[0] : '?';
+    long long ansTime = r->addAnswear(conn.player, choice, conn.lastRead);
+    if (ansTime < 0)
+        return;
+    Player &player = *players.get(conn.player);
+
+    // the points are added up when the round ends
+    bool correct = answear == r->question->correctAnswear;
+    if (correct)
+        printf("MH:Player %s answeared correctly\n", player.getNickname().c_str());
+    // a NUL would end the host's text message early
+    if (answear.find('\0') != std::string_view::npos)
+        answear = "?";
+    reportAnswear(fdOf(r->owner), player, correct, answear, ansTime);
+
+    // binary clients learn their answear was counted
+    static const Frame ack = binaryFrame(Op::AnswearAck, "");
+    if (conn.binary)
+        sendFrame(conn.fd, ack);
+
+    if (r->allAnsweared())
+        endRound(r);
+}
 
-        strcpy(createQuizMsg, "MH:Which answear is correct? (A,B,C,D)\n");
-        if (send(clientFd, createQuizMsg, strlen(createQuizMsg) + 1, MSG_DONTWAIT) != (int)strlen(createQuizMsg) + 1)
-        {
-            std::unique_lock<std::mutex> lock(clientFdsLock);
-            perror("Send error (menu)");
-            clientFds.erase(clientFd);
-        }
+void reportAnswear(int ownerFd, Player &player, bool correct, std::string_view answear, long long ansTime)
+{
+    std::string msg = "MH:Player ";
+    msg += player.getNickname();
+    if (correct)
+    {
+        msg += " has answeared correctly in ";
+        msg += std::to_string(ansTime);
+        msg += " miliseconds\n";
+    }
+    else
+    {
+        msg += " gave a wrong answear( ";
+        msg += answear;
+        msg += ")\n";
+    }
+    sendMessage(ownerFd, msg);
+}
 
-        do
-        {
-            memset(buffer, 0, 4096);
-            count = read(clientFd, buffer, 4096);
-            if (count < 0)
-            {
-                perror("Read error (menu)");
-                std::unique_lock<std::mutex> lock(clientFdsLock);
-                clientFds.erase(clientFd);
-                playersConnected--;
-            }
-        } while (strcmp(buffer, "A\n") != 0 && strcmp(buffer, "B\n") != 0 && strcmp(buffer, "C\n") != 0 && strcmp(buffer, "D\n") != 0);
-        buffer[count - 1] = '\0';
-        newQuestion.correctAnswear = buffer;
+void handleLeave(Connection &conn)
+{
+    auto room = gameRooms.find(conn.roomId);
+    Player &player = *players.get(conn.player);
+    player.setWaiting(false);
+    if (room == gameRooms.end())
+    {
+        sendMainMenu(conn);
+        return;
+    }
 
-        // only 20 seconds per question. period.
-        newQuestion.answearTime = 20;
-        quiz.addQuestion(newQuestion);
+    // takes player back to main menu
+    Room &currentRoom = *room->second;
+    currentRoom.removePlayer(conn.player);
+    printf("MH:Player has left the room\n");
+    std::string menuMsg = "Player ";
+    menuMsg += player.getNickname();
+    menuMsg += " has left your room !\n";
+    queueLobbyInfo(currentRoom);
+    sendMessage(fdOf(currentRoom.owner), menuMsg);
+    sendMainMenu(conn);
+    touchLobby(room->second);
+}
 
-        do
-        {
-            strcpy(createQuizMsg, "MH:Create another question - type \"1\"\nFinish quiz - type \"2\"\n");
-            if (send(clientFd, createQuizMsg, strlen(createQuizMsg) + 1, MSG_DONTWAIT) != (int)strlen(createQuizMsg) + 1)
-            {
-                std::unique_lock<std::mutex> lock(clientFdsLock);
-                perror("Send error (menu)");
-                clientFds.erase(clientFd);
-            }
-            memset(buffer, 0, 4096);
-            count = read(clientFd, buffer, 4096);
-            if (count < 0)
-            {
-                perror("Read error (menu)");
-                std::unique_lock<std::mutex> lock(clientFdsLock);
-                clientFds.erase(clientFd);
-                playersConnected--;
-            }
-        } while (strcmp(buffer, "1\n") != 0 && strcmp(buffer, "2\n") != 0);
-    } while (strcmp(buffer, "2\n") != 0);
-    quizSet.push_back(quiz);
+void sendScoreBoard(Room &room)
+{
+    // the ranking is already sorted, only the top needs names
+    std::string scoreBoardMsg = "S:Scoreboard:\n";
+    int place = 1;
+    for (auto it = room.ranking.begin(); it != room.ranking.end() && place <= SCOREBOARD_SIZE; ++it, ++place)
+    {
+        scoreBoardMsg += std::to_string(place);
+        scoreBoardMsg += ". ";
+        scoreBoardMsg += players.get(room.members[it->second])->getNickname();
+        scoreBoardMsg += " ";
+        scoreBoardMsg += std::to_string(-it->first);
+        scoreBoardMsg += " points\n";
+    }
 
-    strcpy(createQuizMsg, "MH:Quiz created!\n");
-    if (send(clientFd, createQuizMsg, strlen(createQuizMsg) + 1, MSG_DONTWAIT) != (int)strlen(createQuizMsg) + 1)
+    Frame scoreBoard = encodeMessage(scoreBoardMsg, false);
+    Frame scoreBoardBinary = encodeMessage(scoreBoardMsg, true);
+    sendFrame(fdOf(room.owner), scoreBoard, scoreBoardBinary);
+    int ranked = room.ranking.size();
+    for (int i = 0; i < (int)room.members.size(); i++)
     {
-        std::unique_lock<std::mutex> lock(clientFdsLock);
-        perror("Send error (menu)");
-        clientFds.erase(clientFd);
+        if (!room.connected[i])
+            continue;
+        int clientFd = fdOf(room.members[i]);
+        sendFrame(clientFd, scoreBoard, scoreBoardBinary);
+        int rank = room.rankOf(i);
+        if (rank > SCOREBOARD_SIZE)
+        {
+            std::string yourScoreMsg = "MH:Your score: ";
+            yourScoreMsg += std::to_string(room.scores[i]);
+            yourScoreMsg += " points, place ";
+            yourScoreMsg += std::to_string(rank);
+            yourScoreMsg += " of ";
+            yourScoreMsg += std::to_string(ranked);
+            yourScoreMsg += "\n";
+            sendMessage(clientFd, yourScoreMsg);
+        }
     }
 }
 
-void loadSampleQuizzes()
+void loadSampleQuizzes(QuizCatalog &catalog)
 {
     Question sampleQuestion;
     sampleQuestion.questionText = "A is the correct answear.";
@@ -1198,7 +3871,7 @@ void loadSampleQuizzes()
     sampleQuestion.answearC = "Answear 3";
     sampleQuestion.answearD = "Answear 4";
     sampleQuestion.correctAnswear = "A";
-    sampleQuestion.answearTime = 20;
+    sampleQuestion.answearTime = ANSWEAR_TIME;
 
     Quiz sampleQuizA;
     sampleQuizA.addQuestion(sampleQuestion);
@@ -1213,7 +3886,7 @@ void loadSampleQuizzes()
     sampleQuestion.answearC = "Answear 3";
     sampleQuestion.answearD = "Answear 4";
     sampleQuestion.correctAnswear = "B";
-    sampleQuestion.answearTime = 20;
+    sampleQuestion.answearTime = ANSWEAR_TIME;
 
     Quiz sampleQuizB;
     sampleQuizB.addQuestion(sampleQuestion);
@@ -1227,36 +3900,73 @@ void loadSampleQuizzes()
     sampleQuestion.answearC = "Answear 3";
     sampleQuestion.answearD = "Answear 4";
     sampleQuestion.correctAnswear = "C";
-    sampleQuestion.answearTime = 20;
+    sampleQuestion.answearTime = ANSWEAR_TIME;
 
     Quiz sampleQuizC;
     sampleQuizC.addQuestion(sampleQuestion);
     sampleQuizC.addQuestion(sampleQuestion);
     sampleQuizC.quizTitle = "Sample quiz C";
 
-    quizSet.push_back(sampleQuizA);
-    quizSet.push_back(sampleQuizB);
-    quizSet.push_back(sampleQuizC);
-}
-
-void sendLobbyInfo(Room room){
-    char menuMsg2[MAXLENGTH] = "MP:You have joined the room. Room id:";
-                strcat(menuMsg2, std::to_string(room.RoomId).c_str());
-                strcat(menuMsg2, "\nQuiz title :");
-                strcat(menuMsg2,room.quiz.quizTitle.c_str());
-                strcat(menuMsg2, "\nWaiting for the game to start. Type 3 to go back.\n");
-                strcat(menuMsg2, "Players in room:\n");
-                for(int p : room.playersInRoom){
-                    strcat(menuMsg2,players_map.find(p)->second.getNickname().c_str());
-                    strcat(menuMsg2, "\n");
-                }
-                for(int p : room.playersInRoom){
-                    if (send(players_map.find(p)->second.getPlayerID(), menuMsg2, strlen(menuMsg2) + 1, MSG_DONTWAIT) != (int)strlen(menuMsg2) + 1)
-                    {
-                        std::unique_lock<std::mutex> lock(clientFdsLock);
-                        perror("Send error (menu)");
-                        clientFds.erase(players_map.find(p)->second.getPlayerID());
-                        break;
-                    }
-                }
-}
\ No newline at end of file
+    catalog.add(std::make_shared<const Quiz>(std::move(sampleQuizA)));
+    catalog.add(std::make_shared<const Quiz>(std::move(sampleQuizB)));
+    catalog.add(std::make_shared<const Quiz>(std::move(sampleQuizC)));
+}
+
+void queueLobbyInfo(Room &room)
+{
+    room.lobbyVersion++;
+    if (room.lobbyInfoPending)
+        return;
+    room.lobbyInfoPending = true;
+    pendingLobbyInfo.push_back(room.RoomId);
+}
+
+void sendPendingLobbyInfo()
+{
+    for (int roomId : pendingLobbyInfo)
+    {
+        // the room may have started or closed since
+        auto it = gameRooms.find(roomId);
+        if (it == gameRooms.end() || !it->second->lobbyInfoPending)
+            continue;
+        it->second->lobbyInfoPending = false;
+        if (!it->second->inGame())
+            sendLobbyInfo(*it->second);
+    }
+    pendingLobbyInfo.clear();
+}
+
+std::string lobbyInfo(Room &room)
+{
+    std::string menuMsg = "MP:You have joined the room. Room id:";
+    menuMsg += std::to_string(room.RoomId);
+    menuMsg += "\nQuiz title :";
+    menuMsg += room.quiz->quizTitle;
+    menuMsg += "\nWaiting for the game to start. Type 3 to go back.\n";
+    menuMsg += "Players in room:\n";
+
+    // a full class would make every join resend hundreds of names to everyone
+    size_t listed = std::min<size_t>(room.members.size(), LOBBY_LIST_NAMES);
+    for (size_t i = 0; i < listed; i++)
+    {
+        menuMsg += players.get(room.members[i])->getNickname();
+        menuMsg += "\n";
+    }
+    if (listed < room.members.size())
+        menuMsg += "... and " + std::to_string(room.members.size() - listed) + " more\n";
+    return menuMsg;
+}
+
+void sendLobbyInfo(Room &room)
+{
+    std::string menuMsg = lobbyInfo(room);
+    Frame text = encodeMessage(menuMsg, false);
+    Frame binary = encodeMessage(menuMsg, true);
+    for (size_t i = 0; i < room.members.size(); i++)
+    {
+        if (room.lobbySeen[i] == room.lobbyVersion)
+            continue;
+        room.lobbySeen[i] = room.lobbyVersion;
+        sendFrame(fdOf(room.members[i]), text, binary);
+    }
+}